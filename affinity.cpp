@@ -0,0 +1,83 @@
+#include "affinity.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fstream>
+#include <sstream>
+
+namespace bhft {
+
+    std::vector<int> parseCpuList(const std::string &list) {
+        std::vector<int> cpus;
+        std::stringstream stream(list);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            if (range.empty() || range == "\n") continue;
+            size_t dash = range.find('-');
+            int first = atoi(range.c_str());
+            int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    std::vector<int> isolatedCpus() {
+        std::ifstream file("/sys/devices/system/cpu/isolated");
+        std::string list;
+        std::getline(file, list);
+        return parseCpuList(list);
+    }
+
+    int cpuNode(int cpu) {
+        std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        DIR *dir = opendir(path.c_str());
+        if (dir == nullptr) return 0;
+        int node = 0;
+        while (dirent *entry = readdir(dir)) {
+            if (strncmp(entry->d_name, "node", 4) == 0) {
+                node = atoi(entry->d_name + 4);
+                break;
+            }
+        }
+        closedir(dir);
+        return node;
+    }
+
+    bool placeThread(const ThreadPlacement &placement, const char *name) {
+        bool ok = true;
+        if (placement.cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(placement.cpu, &set);
+            int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (ret != 0) {
+                fprintf(stderr, "%s: pin to cpu %d: %s\n", name, placement.cpu, strerror(ret));
+                ok = false;
+            }
+        }
+        if (placement.fifoPriority >= 0) {
+            sched_param param{};
+            param.sched_priority = placement.fifoPriority;
+            int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (ret != 0) {
+                fprintf(stderr, "%s: SCHED_FIFO %d: %s\n", name, placement.fifoPriority, strerror(ret));
+                ok = false;
+            }
+        }
+        if (placement.localMemory && placement.cpu >= 0) {
+            // MPOL_PREFERRED rather than BIND: fall back to other nodes instead of failing allocations
+            unsigned long nodeMask = 1ul << cpuNode(placement.cpu);
+            if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8) != 0) {
+                perror("set_mempolicy");
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+} // bhft
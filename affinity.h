@@ -0,0 +1,33 @@
+#ifndef HFT_FRAMEWORK_USERDATA_AFFINITY_H
+#define HFT_FRAMEWORK_USERDATA_AFFINITY_H
+
+#include <string>
+#include <vector>
+
+namespace bhft {
+
+    // Where a thread runs and how it is scheduled. Negative values leave the
+    // scheduler's choice alone.
+    struct ThreadPlacement {
+        int cpu = -1;
+        int fifoPriority = -1;
+        // bind the thread's memory policy to the NUMA node of cpu, so buffers it
+        // touches first (socket rings, parse arrays) are allocated there
+        bool localMemory = false;
+    };
+
+    // "2-5,8" -> {2, 3, 4, 5, 8}
+    std::vector<int> parseCpuList(const std::string &list);
+
+    // CPUs removed from the general scheduler with isolcpus=, empty if none.
+    std::vector<int> isolatedCpus();
+
+    // NUMA node of cpu, 0 when the system has none.
+    int cpuNode(int cpu);
+
+    // Applies placement to the calling thread, reports and skips what fails.
+    bool placeThread(const ThreadPlacement &placement, const char *name);
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_AFFINITY_H
@@ -0,0 +1,462 @@
+// Microbenchmarks of the hot paths: frame decode, unmasking, frame encode,
+// key matching, structural scanning, orders parsing and the dedup structures. Prints a table,
+// json=<file> also writes the results for comparing runs; only=<area> runs
+// a single area.
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include "masking.h"
+#include "pipeline.h"
+
+namespace {
+
+    // fastsocket.cpp's unmasking loop before the SIMD kernels, kept as the baseline
+    void legacyUnmask(char *dst, const char *src, size_t count, const uint8_t *mask, size_t index) {
+        if (count < 20) {
+            while (count--) {
+                *dst++ = *src++ ^ mask[(index++) & 3];
+            }
+            return;
+        }
+        while (index & 3) {
+            *dst++ = *src++ ^ mask[(index++) & 3];
+            count--;
+        }
+        uint64_t m = *(uint32_t *) mask;
+        m |= m << 32;
+        auto *d = (uint64_t *) dst;
+        auto *s = (uint64_t *) src;
+        for (auto left = (int64_t) count; left > 0; left -= 8) {
+            *d++ = *s++ ^ m;
+        }
+    }
+
+    // sendLastOutputMessage's masking loop before the SIMD kernels
+    void legacyMask(char *dst, const char *, size_t count, const uint8_t *mask, size_t) {
+        auto m = *(unsigned int *) mask;
+        for (size_t i = 0; i < count; i += sizeof(unsigned)) {
+            *(unsigned int *) (dst + i) ^= m;
+        }
+    }
+
+    volatile char sink;
+    volatile uint64_t sinkValue;
+
+    struct Result {
+        std::string area;
+        std::string name;
+        size_t bytes;
+        double nsPerOp;
+    };
+
+    std::vector<Result> results;
+
+    void report(const char *area, const std::string &name, size_t bytes, double ns) {
+        std::cout << area << "\t" << name << "\t" << bytes << "\t" << std::fixed << std::setprecision(1) << ns
+                  << "\t" << std::setprecision(2) << (bytes != 0 ? (double) bytes / ns : 0.0) << "\n";
+        results.push_back({area, name, bytes, ns});
+    }
+
+    template<typename Operation>
+    double nsPerOp(size_t iterations, Operation &&operation) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) operation(i);
+        auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        return elapsed / (double) iterations;
+    }
+
+    bool verify(const bhft::MaskKernel &kernel) {
+        std::mt19937 random(42);
+        std::vector<char> src(70000), expected(70000), actual(70000 + 64);
+        for (auto &c: src) c = (char) random();
+        const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+        for (size_t size: {0, 1, 3, 7, 15, 17, 31, 33, 63, 65, 100, 127, 1000, 65536}) {
+            for (size_t index = 0; index < 4; ++index) {
+                for (size_t i = 0; i < size; ++i) {
+                    expected[i] = (char) (src[i + 1] ^ mask[(index + i) & 3]);
+                }
+                std::fill(actual.begin(), actual.end(), 0x55);
+                kernel.function(actual.data() + 3, src.data() + 1, size, mask, index);
+                if (memcmp(actual.data() + 3, expected.data(), size) != 0 || actual[size + 3] != 0x55 ||
+                    actual[2] != 0x55) {
+                    std::cout << kernel.name << ": wrong result for size " << size << " index " << index << "\n";
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // StructuralIndex offsets found one byte at a time, -1 for an open string.
+    // Backslashes are expected inside strings only.
+    static int referenceScan(const std::string &text, std::vector<uint32_t> &positions) {
+        positions.clear();
+        bool inString = false;
+        bool escape = false;
+        bool inScalar = false;
+        for (uint32_t i = 0; i < text.size(); ++i) {
+            char c = text[i];
+            if (inString) {
+                if (escape) {
+                    escape = false;
+                } else if (c == '\\') {
+                    escape = true;
+                } else if (c == '"') {
+                    positions.push_back(i);
+                    inString = false;
+                }
+                continue;
+            }
+            bool op = c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+            bool space = c == ' ' || c == '\t' || c == '\n' || c == '\r';
+            if (c == '"') {
+                positions.push_back(i);
+                inString = true;
+            } else if (op || (!space && !inScalar)) {
+                positions.push_back(i);
+            }
+            inScalar = !op && !space && c != '"';
+        }
+        return inString ? -1 : (int) positions.size();
+    }
+
+    // Random token soup with escape runs and quotes landing on every offset of a 64 byte block.
+    bool verify(const bparser::ScanKernel &kernel) {
+        static const char *const stringParts[] = {"a", "x y", "{", ",", ":", "]", "\\\"", "\\\\", "\\\\\\\\",
+                                                  "\\\\\\\"", "\\n", "\\\\\\\\\\\""};
+        static const char *const tokens[] = {"{", "}", "[", "]", ":", ",", " ", "\n", "\t ", "true", "-12.5", "0",
+                                             "null"};
+        std::mt19937 random(42);
+        std::vector<uint32_t> expected;
+        static uint32_t positions[bparser::StructuralIndex::capacity + 1];
+        for (int round = 0; round < 20000; ++round) {
+            std::string text;
+            size_t size = random() % 700;
+            while (text.size() < size) {
+                if (random() % 3 == 0) {
+                    text += '"';
+                    for (int parts = random() % 12; parts > 0; --parts) text += stringParts[random() % 12];
+                    // now and then a string is left open
+                    if (text.size() < size || random() % 8 != 0) text += '"';
+                } else {
+                    text += tokens[random() % 13];
+                }
+            }
+            int wanted = referenceScan(text, expected);
+            int found = kernel.function(text.data(), text.size(), positions, bparser::StructuralIndex::capacity);
+            if (found != wanted || (found > 0 && memcmp(positions, expected.data(), found * sizeof(uint32_t)) != 0)) {
+                std::cout << kernel.name << ": wrong offsets in round " << round << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // An OKX orders push as the exchange sends it, plus the short form the mock exchange sends.
+    const char *okxOrder =
+            R"({"instType":"SPOT","instId":"BTC-USDT","tgtCcy":"","ccy":"","ordId":"651370418437931008",)"
+            R"("clOrdId":"","tag":"","px":"35000.1","sz":"0.0001","notionalUsd":"3.50001","ordType":"limit",)"
+            R"("side":"buy","posSide":"","tdMode":"cash","fillPx":"","tradeId":"","fillSz":"0","fillPnl":"0",)"
+            R"("fillTime":"","fillFee":"0","fillFeeCcy":"","execType":"","accFillSz":"0","fillNotionalUsd":"",)"
+            R"("avgPx":"0","state":"live","lever":"0","attachAlgoClOrdId":"","tpTriggerPx":"",)"
+            R"("tpTriggerPxType":"","tpOrdPx":"","slTriggerPx":"","slTriggerPxType":"","slOrdPx":"",)"
+            R"("attachAlgoOrds":[],"stpId":"","stpMode":"","feeCcy":"BTC","fee":"0","rebateCcy":"USDT",)"
+            R"("source":"","rebate":"0","category":"normal","reduceOnly":"false","cancelSource":"",)"
+            R"("quickMgnType":"","algoClOrdId":"","algoId":"","uTime":"1700000000123","cTime":"1700000000123",)"
+            R"("reqId":"","amendResult":"","code":"0","msg":""})";
+    const char *mockOrder =
+            R"({"instType":"SPOT","instId":"BTC-USDT","ordId":"1042","clOrdId":"","px":"30042.5","sz":"1",)"
+            R"("ordType":"limit","side":"buy","state":"live","uTime":"1700000000123"})";
+
+    std::string ordersPush(const char *order, int count) {
+        std::string push = R"({"arg":{"channel":"orders","instType":"ANY","uid":"614488474791936"},"data":[)";
+        for (int i = 0; i < count; ++i) {
+            if (i > 0) push += ',';
+            push += order;
+        }
+        return push + "]}";
+    }
+
+    std::string serverFrame(const std::string &payload, bool masked) {
+        static const uint8_t key[4] = {0x12, 0x34, 0x56, 0x78};
+        std::string frame;
+        frame += (char) 0x81;
+        size_t size = payload.size();
+        if (size < 126) {
+            frame += (char) (size | (masked ? 0x80 : 0));
+        } else {
+            frame += (char) (126 | (masked ? 0x80 : 0));
+            frame += (char) (size >> 8);
+            frame += (char) size;
+        }
+        if (!masked) return frame + payload;
+        frame.append(reinterpret_cast<const char *>(key), 4);
+        for (size_t i = 0; i < size; ++i) frame += (char) (payload[i] ^ key[i & 3]);
+        return frame;
+    }
+
+    bhft::SocketOptions memoryOptions() {
+        bhft::SocketOptions options;
+        options.transport = bhft::inMemory;
+        return options;
+    }
+
+    void benchMasking() {
+        const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+        std::vector<char> src(65536 + 64, 'a');
+        std::vector<char> dst(65536 + 64);
+        bool usable[bhft::maskKernelCount];
+        for (int i = 0; i < bhft::maskKernelCount; ++i) {
+            usable[i] = bhft::maskKernels[i].supported() && verify(bhft::maskKernels[i]);
+        }
+        auto measure = [&](bhft::maskFunction function, char *to, const char *from, size_t size) {
+            size_t iterations = std::max<size_t>(1000, (256u << 20) / size);
+            return nsPerOp(iterations, [&](size_t i) {
+                function(to, from, size, mask, 0);
+                sink = to[i % size];
+            });
+        };
+        for (size_t size: {100, 256, 1024, 4096, 16384, 65536}) {
+            report("unmask", "legacy", size, measure(legacyUnmask, dst.data(), src.data(), size));
+            report("mask", "legacy", size, measure(legacyMask, dst.data(), dst.data(), size));
+            for (int i = 0; i < bhft::maskKernelCount; ++i) {
+                const bhft::MaskKernel &kernel = bhft::maskKernels[i];
+                if (!usable[i]) continue;
+                report("unmask", kernel.name, size, measure(kernel.function, dst.data(), src.data(), size));
+                report("mask", kernel.name, size, measure(kernel.function, dst.data(), dst.data(), size));
+            }
+        }
+    }
+
+    // getMessage on frames already in the receive ring, refilled outside the timed part.
+    void benchDecode() {
+        bhft::WebSocket ws("", 0, "", false, memoryOptions());
+        bhft::MirroredBuffer &ring = ws.socket.ring;
+        std::vector<char> buffer(65536 + 64);
+        for (bool masked: {false, true}) {
+            for (int orders: {1, 8}) {
+                std::string frame = serverFrame(ordersPush(okxOrder, orders), masked);
+                size_t perFill = ring.capacity / 2 / frame.size();
+                size_t rounds = std::max<size_t>(10, 200000 / perFill);
+                double totalNs = 0;
+                for (size_t round = 0; round < rounds; ++round) {
+                    ring.release();
+                    for (size_t i = 0; i < perFill; ++i) {
+                        memcpy(ring.writePtr(), frame.data(), frame.size());
+                        ring.produce(frame.size());
+                    }
+                    totalNs += nsPerOp(perFill, [&](size_t) {
+                        bhft::Message message(buffer.data() + 1, buffer.size() - 2);
+                        ws.getMessage(message, false, true);
+                        sink = *message.begin;
+                    });
+                }
+                std::string name = std::string(masked ? "masked" : "unmasked") + " orders=" + std::to_string(orders);
+                report("decode", name, frame.size(), totalNs / (double) rounds);
+            }
+        }
+    }
+
+    // sendLastOutputMessage and the writeMessage gather into the memory sink.
+    void benchEncode() {
+        std::string payload = ordersPush(mockOrder, 1);
+        HFTSocket hftSocket(0, memoryOptions(), threadSync.pipeline[0], nullptr);
+        InputData inputData[InputDataSet::capacity];
+        InputDataSet inputDataSet(inputData, inputData, inputData + InputDataSet::capacity);
+        std::string parsed = payload;
+        bhft::Message message(&parsed[0]);
+        message.end += parsed.size();
+        QuoteObjectCallback callback(&hftSocket.ws, inputDataSet);
+        bparser::input(message).parseObject(&callback);
+        for (bool masked: {false, true}) {
+            hftSocket.ws.useMask = masked;
+            uint64_t before = hftSocket.ws.socket.streamOffset;
+            double ns = nsPerOp(1000000, [&](size_t) {
+                hftSocket.ws.getOutputMessage().write(payload.data(), payload.data() + payload.size());
+                hftSocket.ws.sendLastOutputMessage(bhft::wsheader_type::TEXT_FRAME);
+            });
+            size_t bytes = (hftSocket.ws.socket.streamOffset - before) / 1000000;
+            report("encode", std::string("sendLastOutputMessage ") + (masked ? "masked" : "unmasked"), bytes, ns);
+            before = hftSocket.ws.socket.streamOffset;
+            ns = nsPerOp(1000000, [&](size_t) {
+                hftSocket.writeMessage(inputData[0]);
+            });
+            bytes = (hftSocket.ws.socket.streamOffset - before) / 1000000;
+            report("encode", std::string("writeMessage ") + (masked ? "masked" : "unmasked"), bytes, ns);
+        }
+    }
+
+    // StructuralIndex::build alone, per kernel.
+    void benchScan() {
+        static bparser::StructuralIndex index;
+        bool usable[bparser::scanKernelCount];
+        for (int i = 0; i < bparser::scanKernelCount; ++i) {
+            usable[i] = bparser::scanKernels[i].supported() && verify(bparser::scanKernels[i]);
+        }
+        for (int count: {1, 8}) {
+            std::string payload = ordersPush(okxOrder, count);
+            int expected = -1;
+            for (int i = 0; i < bparser::scanKernelCount; ++i) {
+                const bparser::ScanKernel &kernel = bparser::scanKernels[i];
+                if (!usable[i]) continue;
+                int found = kernel.function(payload.data(), payload.size(), index.positions,
+                                            bparser::StructuralIndex::capacity);
+                if (expected != -1 && found != expected) {
+                    std::cout << kernel.name << ": " << found << " offsets instead of " << expected << "\n";
+                }
+                expected = found;
+                double ns = nsPerOp(1000000, [&](size_t) {
+                    sinkValue = kernel.function(payload.data(), payload.size(), index.positions,
+                                                bparser::StructuralIndex::capacity);
+                });
+                report("scan", std::string(kernel.name) + " okx orders=" + std::to_string(count), payload.size(), ns);
+            }
+        }
+    }
+
+    void benchParse() {
+        static bparser::StructuralIndex index;
+        InputData inputData[InputDataSet::capacity];
+        struct Case {
+            const char *name;
+            const char *order;
+            int count;
+        };
+        auto run = [&](bool scan, bool virtualCalls) {
+            for (const Case &c: {Case{"okx orders=1", okxOrder, 1}, Case{"okx orders=8", okxOrder, 8},
+                                 Case{"mock orders=1", mockOrder, 1}}) {
+                std::string payload = ordersPush(c.order, c.count);
+                bhft::Message message(&payload[0]);
+                message.end += payload.size();
+                long parsed = 0;
+                double ns = nsPerOp(200000, [&](size_t) {
+                    InputDataSet inputDataSet(inputData, inputData, inputData + InputDataSet::capacity);
+                    QuoteObjectCallback callback(nullptr, inputDataSet);
+                    // the index is rebuilt every time, as parseMessage does
+                    bool indexed = scan && index.build(message.begin, message.end);
+                    bparser::input in(message, indexed ? &index : nullptr);
+                    if (virtualCalls) {
+                        in.parseObject<bparser::ObjectCallback>(&callback);
+                    } else {
+                        in.parseObject(&callback);
+                    }
+                    parsed += inputDataSet.end - inputDataSet.begin;
+                });
+                std::string name = std::string(c.name) + (compiledKeys ? " keys=compiled" : " keys=dfa") +
+                                   (scan ? " scan=" + std::string(bparser::scanKernelName()) : " scan=bytes") +
+                                   (virtualCalls ? " callbacks=virtual" : " callbacks=static");
+                if (parsed != 200000L * c.count) std::cout << name << ": parsed " << parsed << " orders\n";
+                report("parse", name, payload.size(), ns);
+            }
+        };
+        for (bool compiled: {false, true}) {
+            compiledKeys = compiled;
+            for (bool scan: {false, true}) run(scan, false);
+        }
+        // the dispatch alone, with the fastest keys
+        for (bool scan: {false, true}) run(scan, true);
+        compiledKeys = true;
+    }
+
+    // Every key of an OKX order, per key: the runtime DFA against the compiled matcher.
+    void benchKeys() {
+        std::vector<std::pair<const char *, size_t>> keys;
+        for (const char *p = okxOrder; (p = strstr(p, "\":")) != nullptr; ++p) {
+            const char *start = p - 1;
+            while (*start != '"') --start;
+            keys.emplace_back(start + 1, p - start - 1);
+        }
+        size_t bytes = 0;
+        for (auto &key: keys) bytes += key.second;
+        std::cout << "dfa: " << dataObjectIdMap->stateCount << " states x " << dataObjectIdMap->classCount
+                  << " classes, " << dataObjectIdMap->stateCount * dataObjectIdMap->classCount * sizeof(uint16_t)
+                  << " bytes of transitions\n";
+        long matched = 0;
+        double ns = nsPerOp(1000000, [&](size_t) {
+            for (auto &key: keys) {
+                // what parseIdentifier does past the opening quote
+                const char *p = key.first;
+                matched += dataObjectIdMap->match(p, key.first + key.second + 1) >= 0;
+            }
+        });
+        report("keys", "dfa", bytes / keys.size(), ns / (double) keys.size());
+        long compiledMatched = 0;
+        ns = nsPerOp(1000000, [&](size_t) {
+            for (auto &key: keys) compiledMatched += matchDataObjectKey(key.first, key.second) >= 0;
+        });
+        if (matched != compiledMatched) {
+            std::cout << "keys: dfa matched " << matched << ", compiled " << compiledMatched << "\n";
+        }
+        report("keys", "compiled", bytes / keys.size(), ns / (double) keys.size());
+    }
+
+    void benchDedup() {
+        for (uint64_t id = 1; id <= ThreadSync::dataSize; ++id) threadSync.add(id);
+        report("dedup", "ThreadSync::getCount hit", 0, nsPerOp(1000000, [](size_t i) {
+            sinkValue = threadSync.getCount(1 + i % ThreadSync::dataSize);
+        }));
+        report("dedup", "ThreadSync::getCount miss", 0, nsPerOp(1000000, [](size_t i) {
+            sinkValue = threadSync.getCount(1000000 + i);
+        }));
+        report("dedup", "ThreadSync::add", 0, nsPerOp(1000000, [](size_t i) {
+            threadSync.add(1000000 + i);
+        }));
+        // every key is new once, then all of them repeat
+        const size_t keys = 100000;
+        bhft::DedupSet orders;
+        orders.init(1 << 18, 5000);
+        report("dedup", "DedupSet::claim new", 0, nsPerOp(keys, [&](size_t i) {
+            sinkValue = orders.claim(1 + i);
+        }));
+        report("dedup", "DedupSet::claim duplicate", 0, nsPerOp(10 * keys, [&](size_t i) {
+            sinkValue = orders.claim(1 + i % keys);
+        }));
+    }
+
+    bool writeJson(const std::string &path) {
+        std::ofstream out(path);
+        if (!out) return false;
+        out << "{\"maskKernel\":\"" << bhft::maskCopyName() << "\",\"scanKernel\":\""
+            << bparser::scanKernelName() << "\",\"results\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result &result = results[i];
+            out << (i == 0 ? "" : ",") << "\n  {\"area\":\"" << result.area << "\",\"name\":\"" << result.name
+                << "\",\"bytes\":" << result.bytes << ",\"nsPerOp\":" << std::fixed << std::setprecision(2)
+                << result.nsPerOp << "}";
+        }
+        out << "\n]}\n";
+        return (bool) out;
+    }
+}
+
+int main(int argc, char **argv) {
+    std::map<std::string, std::string> map;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t index = arg.find('=');
+        if (index == std::string::npos) return -1;
+        map[arg.substr(0, index)] = arg.substr(index + 1);
+    }
+    std::string only = map["only"];
+    std::cout << "startup kernel: " << bhft::maskCopyName() << ", scan " << bparser::scanKernelName() << "\n";
+    std::cout << "area\tname\tbytes\tns/op\tGB/s\n";
+    if (only.empty() || only == "decode") benchDecode();
+    if (only.empty() || only == "mask") benchMasking();
+    if (only.empty() || only == "encode") benchEncode();
+    if (only.empty() || only == "keys") benchKeys();
+    if (only.empty() || only == "scan") benchScan();
+    if (only.empty() || only == "parse") benchParse();
+    if (only.empty() || only == "dedup") benchDedup();
+    if (!map["json"].empty() && !writeJson(map["json"])) {
+        std::cout << "Cannot write " << map["json"] << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "bparser.h"
+#include <stdio.h>
+#include <array>
+#include <map>
+#include <vector>
+
+namespace bparser {
+
+    KeyDfa *buildStateMachine(const char *const *ids, int count) {
+        // a trie over raw bytes first: state 0 is the unknown key, 1 the start
+        // and a quote ends the key everywhere
+        std::vector<std::array<uint16_t, 256>> trie(2);
+        auto addState = [&trie]() {
+            trie.emplace_back();
+            return (uint16_t) (trie.size() - 1);
+        };
+        for (auto &row: trie) row.fill(0);
+        for (int i = 0; i < count; ++i) {
+            uint16_t current = 1;
+            for (const char *ptr = ids[i]; *ptr != 0; ++ptr) {
+                auto byte = (uint8_t) *ptr;
+                if (trie[current][byte] == 0) {
+                    uint16_t added = addState();
+                    trie[added].fill(0);
+                    trie[current][byte] = added;
+                }
+                current = trie[current][byte];
+            }
+            trie[current]['"'] = KeyDfa::terminal | (i + 1);
+        }
+        for (auto &row: trie) {
+            if (row['"'] == 0) row['"'] = KeyDfa::terminal;
+        }
+        // bytes with the same column in every state share a class
+        auto *dfa = new KeyDfa();
+        dfa->stateCount = (int) trie.size();
+        std::map<std::vector<uint16_t>, int> classes;
+        uint8_t representative[256];
+        for (int byte = 0; byte < 256; ++byte) {
+            std::vector<uint16_t> column(trie.size());
+            for (size_t s = 0; s < trie.size(); ++s) column[s] = trie[s][byte];
+            auto inserted = classes.emplace(column, (int) classes.size());
+            if (inserted.second) representative[inserted.first->second] = (uint8_t) byte;
+            dfa->byteClass[byte] = (uint8_t) inserted.first->second;
+        }
+        dfa->classCount = (int) classes.size();
+        if (dfa->stateCount * dfa->classCount >= KeyDfa::terminal) {
+            fprintf(stderr, "%i keys are too many for a KeyDfa, none of them will match\n", count);
+            delete dfa;
+            return buildStateMachine(nullptr, 0);
+        }
+        dfa->transitions = new uint16_t[dfa->stateCount * dfa->classCount];
+        for (int s = 0; s < dfa->stateCount; ++s) {
+            for (int c = 0; c < dfa->classCount; ++c) {
+                uint16_t next = trie[s][representative[c]];
+                dfa->transitions[s * dfa->classCount + c] = next & KeyDfa::terminal ? next : next * dfa->classCount;
+            }
+        }
+        return dfa;
+    }
+
+    KeyDfa *unknownIds = buildStateMachine(nullptr, 0);
+
+    bool logger::enabled = false;
+
+    logger::logger(char *file, int line, char *begin, char *current, char *anEnd) : file(file), line(line),
+                                                                                    begin(begin), current(current),
+                                                                                    end(anEnd) {}
+} // bparser
@@ -0,0 +1,347 @@
+#ifndef HFT_FRAMEWORK_USERDATA_BPARSER_H
+#define HFT_FRAMEWORK_USERDATA_BPARSER_H
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include "fastsocket.h"
+#include "keymatcher.h"
+#include "structural.h"
+
+namespace bparser {
+
+    struct KeyDfa;
+    struct ObjectCallback;
+
+    // input::parseObject and parseArray are templates on the callback type.
+    // Called with these interfaces every event is a virtual call; called with
+    // a final callback whose willParse* return final types, the whole handler
+    // chain is known at compile time and inlines into the parser.
+    struct ArrayCallback {
+
+        virtual ArrayCallback *willParseArray() = 0;
+
+        virtual ObjectCallback *willParseObject() = 0;
+
+        virtual void nextValue(const char *begin, const char *end) = 0;
+
+        virtual void arrayFinished() = 0;
+    };
+
+    // Field id of a key, -1 if unknown, for key sets compiled into a KeyMatcher.
+    typedef int (*keyMatch)(const char *key, size_t length);
+
+    struct ObjectCallback {
+        KeyDfa *idMap;
+        // used instead of idMap when set
+        keyMatch matchKey;
+
+        explicit ObjectCallback(KeyDfa *idMap, keyMatch matchKey = nullptr) : idMap(idMap), matchKey(matchKey) {}
+
+        virtual void valueForField(int field_id, const char *begin, const char *end) = 0;
+
+        virtual ObjectCallback *willParseObject(int field_id) = 0;
+
+        virtual ArrayCallback *willParseArray(int field_id) = 0;
+
+        virtual void objectFinished() = 0;
+    };
+
+    // Key matcher for key sets known at runtime: a DFA over byte classes
+    // with all transitions in one table. Bytes that take every state to the
+    // same place share a class, so the seven order keys need a couple dozen
+    // classes and states, about 1 KB. Row 0 is the unknown key, the start
+    // state is row 1.
+    struct KeyDfa {
+        // entries with this bit set end the key, the rest is the field id + 1;
+        // other entries are the offset of the next state's row
+        static const uint16_t terminal = 0x8000;
+
+        uint8_t byteClass[256];
+        int classCount;
+        int stateCount;
+        // stateCount rows of classCount entries
+        uint16_t *transitions;
+
+        // From past the opening quote: the field id, -1 for unknown keys or
+        // -2 at end. current is left past the closing quote.
+        int match(const char *&current, const char *end) const {
+            // locals: stores through current could alias the tables
+            const char *position = current;
+            const uint16_t *table = transitions;
+            const uint8_t *classes = byteClass;
+            unsigned next = classCount;
+            while (position != end) {
+                next = table[next + classes[(uint8_t) *position++]];
+                if (next & terminal) {
+                    current = position;
+                    return (int) (next & ~terminal) - 1;
+                }
+            }
+            current = position;
+            return -2;
+        }
+    };
+
+    KeyDfa *buildStateMachine(const char *const *ids, int count);
+
+    // matches no field, for objects nobody listens to
+    extern KeyDfa *unknownIds;
+
+    struct logger {
+        static bool enabled;
+        char *file;
+        int line;
+        char *begin;
+        char *current;
+        char *end;
+
+        logger(char *file, int line, char *begin, char *current, char *anEnd);
+
+
+        void operator()(const char *format, ...) {
+            if (!enabled) return;
+            std::string str(begin, end);
+            std::replace(str.begin(), str.end(), '\n', ' ');
+            std::cout << str << "\n";
+            std::cout << std::string(current - begin, ' ') << "^\n";
+
+            char buf[1024];
+            va_list args;
+            va_start(args, format);
+            vsprintf(buf, format, args);
+            va_end(args);
+            std::cout << "[" << file << ":" << line << "] " << buf << "\n";
+        }
+
+    };
+
+
+
+//#define INLOG logger(__FILE__, __LINE__, begin, current, end)
+
+
+    struct input {
+        const char *begin;
+        const char *current;
+        const char *end;
+        // next offset of a StructuralIndex built for this message, null to
+        // look at every byte
+        const uint32_t *structural;
+
+        explicit input(bhft::Message &message, const StructuralIndex *index = nullptr) {
+            begin = message.begin;
+            current = message.begin;
+            end = message.end;
+            structural = index == nullptr ? nullptr : index->positions;
+        }
+
+        void log(const std::string &message) {
+            std::cout << message << ": " << *current;
+        }
+
+        static bool is_whitespace(char c) {
+            return strchr(" \t\n\r", c) != nullptr;
+        }
+
+        static bool isEndOfValue(char c) {
+            return strchr(", ]}\t\n\r", c) != nullptr;
+        }
+
+        // first structural offset at or past current, end past the last one
+        const char *nextStructural() {
+            while (begin + *structural < current) ++structural;
+            return begin + *structural;
+        }
+
+        int skipSpaces() {
+            if (structural != nullptr) {
+                current = nextStructural();
+                return (current == end) ? -2 : 0;
+            }
+            while (current != end && is_whitespace(*current)) {
+                ++current;
+            }
+            return (current == end) ? -2 : 0;
+        }
+
+        int parseIdentifier(KeyDfa *idMap) {
+            if (skipSpaces() == -2) {
+                //INLOG("Wrong spaces");
+                return -2;
+            }
+            if (*current++ != '"') {
+                //INLOG("Not a \"");
+                return -2;
+            }
+            //INLOG("Start parsing identifier \"");
+            int result = idMap->match(current, end);
+            return current == end ? -2 : result;
+        }
+
+        // parseIdentifier for a key set compiled into match
+        int parseKey(keyMatch match) {
+            if (skipSpaces() == -2) {
+                return -2;
+            }
+            if (*current++ != '"') {
+                return -2;
+            }
+            const char *key = current;
+            if (structural != nullptr) {
+                current = nextStructural();
+                if (current == end || *current != '"') return -2;
+                return match(key, current++ - key);
+            }
+            current = static_cast<const char *>(memchr(key, '"', end - key));
+            if (current == nullptr) {
+                current = end;
+                return -2;
+            }
+            return match(key, current++ - key);
+        }
+
+        int parseSimpleValue() {
+            if (skipSpaces() == -2) {
+                //INLOG("Wrong spaces");
+            }
+            if (structural != nullptr) return parseIndexedValue();
+            if (*current++ == '"') {
+                bool prevIsSlash = false;
+                while (current < end && (*current != '"' || prevIsSlash)) {
+                    if (prevIsSlash) {
+                        prevIsSlash = false;
+                    } else if (*current == '\\') {
+                        prevIsSlash = true;
+                    }
+                    ++current;
+                }
+                return current == end || *current++ != '"' ? -2 : 0;
+            } else {
+                while (current < end && !isEndOfValue(*current)) { ++current; }
+                return current == end ? -2 : 0;
+            }
+        }
+
+        // parseSimpleValue with the index: the closing quote of a string is
+        // the next offset, a bare value ends where the next token starts
+        int parseIndexedValue() {
+            bool quoted = *current++ == '"';
+            const char *next = nextStructural();
+            if (next == end) return -2;
+            if (quoted) {
+                if (*next != '"') return -2;
+                current = next + 1;
+                return 0;
+            }
+            while (is_whitespace(next[-1])) --next;
+            current = next;
+            return 0;
+        }
+
+        template<typename Array>
+        [[maybe_unused]] int parseArray(Array *arr) {
+            if (skipSpaces() == -2) {
+                //INLOG("Wrong spaces");
+                return -2;
+            }
+            if (*current++ != '[') {
+                //INLOG("Not array");
+                return -2;
+            }
+            if (skipSpaces() == -2) {
+                //INLOG("Wrong spaces");
+                return -2;
+            }
+            if (*current == ']') {
+                current++;
+                return 0;
+            }
+            do {
+                if (skipSpaces() == -2) {
+                    //INLOG("Wrong spaces");
+                    return -2;
+                }
+                if (*current == '{') {
+                    if (parseObject(arr == nullptr ? nullptr : arr->willParseObject()) == -2) return -2;
+                } else if (*current != '[') {
+                    if (parseArray(arr == nullptr ? nullptr : arr->willParseArray()) == -2) return -2;
+                } else {
+                    const char *start = current;
+                    if (parseSimpleValue() == -2) return -2;
+                    const char *finish = current;
+                    if (arr != nullptr) arr->nextValue(start, finish);
+                }
+                if (skipSpaces() == -2) {
+                    //INLOG("Wrong spaces");
+                    return -2;
+                }
+            } while (*current++ == ',');
+            if (current[-1] != ']') {
+                //INLOG("Not end of array");
+                return -2;
+            }
+            if (arr != nullptr) arr->arrayFinished();
+            return 0;
+        }
+
+        template<typename Object>
+        int parseObject(Object *obj) {
+            if (skipSpaces() == -2) {
+                //INLOG("Wrong spaces");
+                return -2;
+            }
+            if (*current++ != '{') {
+                return -2;
+            }
+            if (skipSpaces() == -2) {
+                //INLOG("Wrong spaces");
+                return -2;
+            }
+            if (*current == '}') {
+                ++current;
+                return 0;
+            }
+            do {
+                if (skipSpaces() == -2) {
+                    //INLOG("Wrong spaces");
+                    return -2;
+                }
+                int id = obj != nullptr && obj->matchKey != nullptr ? parseKey(obj->matchKey)
+                                                                    : parseIdentifier(obj == nullptr ? unknownIds
+                                                                                                     : obj->idMap);
+                if (skipSpaces() == -2) {
+                    //INLOG("Wrong spaces");
+                    return -2;
+                }
+                if (*current++ != ':') return -2;
+                if (skipSpaces() == -2) {
+                    //INLOG("Wrong spaces");
+                    return -2;
+                }
+                if (*current == '{') {
+                    if (parseObject(obj == nullptr ? nullptr : obj->willParseObject(id)) == -2) return -2;
+                } else if (*current == '[') {
+                    if (parseArray(obj == nullptr ? nullptr : obj->willParseArray(id)) == -2) return -2;
+                } else {
+                    const char *start = current;
+                    if (parseSimpleValue() == -2) return -2;
+                    const char *finish = current;
+                    if (obj != nullptr) obj->valueForField(id, start, finish);
+                }
+                if (skipSpaces() == -2) {
+                    //INLOG("Wrong spaces");
+                    return -2;
+                }
+            } while (*current++ == ',');
+            if (current[-1] != '}') return -2;
+            if (obj != nullptr) obj->objectFinished();
+            return 0;
+        }
+    };
+} // bparser
+
+#endif //HFT_FRAMEWORK_USERDATA_BPARSER_H
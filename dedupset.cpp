@@ -0,0 +1,125 @@
+#include "dedupset.h"
+#include <immintrin.h>
+#include <time.h>
+
+namespace bhft {
+
+    bool DedupSet::init(size_t minCapacity, uint64_t windowMilliSec) {
+        capacity = 2;
+        shift = 63;
+        while (capacity < minCapacity) {
+            capacity <<= 1;
+            --shift;
+        }
+        generationMilliSec = windowMilliSec / generationsPerWindow;
+        if (generationMilliSec == 0) generationMilliSec = 1;
+        slots = new Slot[capacity];
+        return slots != nullptr;
+    }
+
+    DedupSet::~DedupSet() {
+        delete[] slots;
+    }
+
+    uint32_t DedupSet::currentGeneration() {
+        // the coarse clock is a plain vDSO read, window precision is a generation anyway
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        uint64_t milliSec = now.tv_sec * 1000ull + now.tv_nsec / 1000000;
+        // start at generation window + 1 so never written slots count as expired
+        return (uint32_t) (milliSec / generationMilliSec) + generationsPerWindow + 1;
+    }
+
+    uint64_t DedupSet::waitWhileBusy(Slot &slot) {
+        uint64_t current;
+        while ((current = slot.key.load(std::memory_order_acquire)) == busy) {
+            _mm_pause();
+        }
+        return current;
+    }
+
+    void DedupSet::publish(Slot &slot, uint64_t tag, uint32_t now) {
+        slot.seen.store(0, std::memory_order_relaxed);
+        slot.generation.store(now, std::memory_order_relaxed);
+        slot.key.store(tag, std::memory_order_release);
+    }
+
+    uint32_t DedupSet::claim(uint64_t key) {
+        // keys are stored +1 so order id 0 does not collide with empty
+        uint64_t tag = key + 1;
+        size_t home = (tag * 0x9E3779B97F4A7C15ull) >> shift;
+        uint32_t now = currentGeneration();
+        while (true) {
+            // the first reusable slot of the chain, so racing claims of the same key meet on it
+            Slot *free = nullptr;
+            uint64_t freeKey = empty;
+            Slot *oldest = nullptr;
+            uint64_t oldestKey = empty;
+            for (int probe = 0; probe < probeLimit; ++probe) {
+                Slot &slot = slots[(home + probe) & (capacity - 1)];
+                uint64_t current = waitWhileBusy(slot);
+                if (current == tag && isLive(slot, now)) {
+                    stats.duplicates.fetch_add(1, std::memory_order_relaxed);
+                    return slot.seen.fetch_add(1, std::memory_order_relaxed) + 1;
+                }
+                if (current == tag) {
+                    // our own key outside the window: claim it in place
+                    free = &slot;
+                    freeKey = current;
+                    break;
+                }
+                if (current == empty) {
+                    if (free == nullptr) {
+                        free = &slot;
+                        freeKey = empty;
+                    }
+                    break;
+                }
+                if (free != nullptr) continue;
+                if (current == abandoned || !isLive(slot, now)) {
+                    free = &slot;
+                    freeKey = current;
+                } else if (oldest == nullptr ||
+                           (int32_t) (slot.generation.load(std::memory_order_relaxed) -
+                                      oldest->generation.load(std::memory_order_relaxed)) < 0) {
+                    oldest = &slot;
+                    oldestKey = current;
+                }
+            }
+            bool premature = free == nullptr;
+            if (premature) {
+                free = oldest;
+                freeKey = oldestKey;
+            }
+            if (!free->key.compare_exchange_strong(freeKey, busy, std::memory_order_acq_rel)) {
+                continue;
+            }
+            // the same key may have been claimed again since we looked at its generation
+            if (freeKey != empty && freeKey != abandoned && !premature && isLive(*free, now)) {
+                free->key.store(freeKey, std::memory_order_release);
+                continue;
+            }
+            if (premature) {
+                stats.prematureEvictions.fetch_add(1, std::memory_order_relaxed);
+            } else if (freeKey != empty && freeKey != abandoned) {
+                stats.expired.fetch_add(1, std::memory_order_relaxed);
+            }
+            publish(*free, tag, now);
+            stats.claims.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+    }
+
+    void DedupSet::abandon(uint64_t key) {
+        uint64_t tag = key + 1;
+        size_t home = (tag * 0x9E3779B97F4A7C15ull) >> shift;
+        for (int probe = 0; probe < probeLimit; ++probe) {
+            Slot &slot = slots[(home + probe) & (capacity - 1)];
+            uint64_t current = waitWhileBusy(slot);
+            if (current == empty) return;
+            // the slot stays occupied so probe chains through it stay intact
+            if (current == tag && slot.key.compare_exchange_strong(current, abandoned)) return;
+        }
+    }
+
+} // bhft
@@ -0,0 +1,74 @@
+#ifndef HFT_FRAMEWORK_USERDATA_DEDUPSET_H
+#define HFT_FRAMEWORK_USERDATA_DEDUPSET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+namespace bhft {
+
+    // Open-addressed set of order keys shared by all connections. The thread
+    // whose CAS puts a key into a free slot owns it and is the only one to
+    // forward it; everybody else only bumps the duplicate counter. No lock is
+    // taken, so the owner never sends while holding anything.
+    //
+    // Keys are remembered for a time window. Time is counted in generations
+    // of window / generationsPerWindow; a slot whose generation is more than
+    // a window old is free for reuse. Only when a whole probe chain is still
+    // inside the window is a live key evicted, which prematureEvictions counts.
+    struct DedupSet {
+        static const uint64_t empty = 0;
+        static const uint64_t abandoned = ~0ull;
+        // slot is being rewritten, readers wait for the new key
+        static const uint64_t busy = ~0ull - 1;
+        static const int probeLimit = 64;
+        static const uint32_t generationsPerWindow = 8;
+
+        struct Slot {
+            std::atomic<uint64_t> key{empty};
+            std::atomic<uint32_t> seen{0};
+            std::atomic<uint32_t> generation{0};
+        };
+
+        struct Stats {
+            std::atomic<uint64_t> claims{0};
+            std::atomic<uint64_t> duplicates{0};
+            std::atomic<uint64_t> expired{0};
+            std::atomic<uint64_t> prematureEvictions{0};
+        };
+
+        Slot *slots = nullptr;
+        size_t capacity = 0;
+        int shift = 64;
+        uint64_t generationMilliSec = 1;
+        Stats stats;
+
+        // Rounds capacity up to a power of two.
+        bool init(size_t minCapacity, uint64_t windowMilliSec);
+
+        ~DedupSet();
+
+        // 0 when the caller now owns key, otherwise how many times it has
+        // been seen within the window (the owner's sighting included).
+        uint32_t claim(uint64_t key);
+
+        // The owner could not forward key: drop it so a later sighting on
+        // another connection claims it again.
+        void abandon(uint64_t key);
+
+    private:
+        uint32_t currentGeneration();
+
+        bool isLive(Slot &slot, uint32_t now) {
+            return now - slot.generation.load(std::memory_order_acquire) <= generationsPerWindow;
+        }
+
+        uint64_t waitWhileBusy(Slot &slot);
+
+        // Finishes a claim of a slot the caller swapped to busy.
+        void publish(Slot &slot, uint64_t tag, uint32_t now);
+    };
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_DEDUPSET_H
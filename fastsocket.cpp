@@ -3,18 +3,49 @@
 //
 
 #include "fastsocket.h"
+#include "uring.h"
+#include "masking.h"
+#include "tscclock.h"
+#include <immintrin.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <sys/ioctl.h>
+
+#ifndef EPIOCSPARAMS
+// kernel 6.9 uapi, sys/epoll.h has it from glibc 2.40
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
 
 namespace bhft {
 
-    Socket::Socket(const std::string &hostname, int port, bool waitOnSocket) : socket(INVALID_SOCKET),
-                                                                               begin(readBuffer), end(readBuffer),
-                                                                               socketClosed(false),
-                                                                               waitOnSocket(waitOnSocket) {
+    Socket::Socket(const std::string &hostname, int port, const SocketOptions &options) : socket(INVALID_SOCKET),
+                                                                                         pendingBegin(nullptr),
+                                                                                         pendingEnd(nullptr),
+                                                                                         socketClosed(false),
+                                                                                         wait(options.wait),
+                                                                                         spinLimit(options.spinLimit),
+                                                                                         epollFd(-1),
+                                                                                         epollWantsWrite(false),
+                                                                                         uring(nullptr),
+                                                                                         memorySink(options.transport == inMemory) {
         struct addrinfo hints;
         struct addrinfo *result;
         struct addrinfo *p;
         int ret;
         char sport[16];
+        if (!ring.init(options.ringSize) || !outbound.init(options.outboundSize)) {
+            socketClosed = true;
+            return;
+        }
+        if (memorySink) return;
         memset(&hints, 0, sizeof(hints));
         hints.ai_family = AF_UNSPEC;
         hints.ai_socktype = SOCK_STREAM;
@@ -34,116 +65,441 @@ namespace bhft {
             socket = INVALID_SOCKET;
         }
         freeaddrinfo(result);
+        // before the handshake, so streamOffset and the kernel's byte count agree
+        if (options.timestamping && socket != INVALID_SOCKET && !enableTimestamping()) {
+            perror("SO_TIMESTAMPING");
+        }
+    }
+
+    bool Socket::enableTimestamping() {
+        // hardware stamps are used when the NIC has them enabled, software otherwise
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                    SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                    SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        timestamping = ::setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+        return timestamping;
+    }
+
+    static uint64_t pickTimestamp(const scm_timestamping *stamps) {
+        const timespec &stamp = stamps->ts[2].tv_sec != 0 ? stamps->ts[2] : stamps->ts[0];
+        return stamp.tv_sec * 1000000000ull + stamp.tv_nsec;
+    }
+
+    ssize_t Socket::receiveTimestamped(char *dst, size_t count) {
+        char control[CMSG_SPACE(sizeof(scm_timestamping))];
+        iovec part{dst, count};
+        msghdr message{};
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t ret = ::recvmsg(socket, &message, 0);
+        if (ret <= 0) return ret;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                if (rxMarkTail - rxMarkHead == rxMarkCount) ++rxMarkHead;
+                RxMark &mark = rxMarks[rxMarkTail++ % rxMarkCount];
+                mark.end = ring.tail + ret;
+                mark.nanoSec = pickTimestamp(reinterpret_cast<scm_timestamping *>(CMSG_DATA(cmsg)));
+            }
+        }
+        return ret;
+    }
+
+    uint64_t Socket::rxTimestampAt(uint64_t end) {
+        // frames are decoded in order, marks before this one are never asked for again
+        while (rxMarkHead != rxMarkTail) {
+            RxMark &mark = rxMarks[rxMarkHead % rxMarkCount];
+            if (mark.end >= end) return mark.nanoSec;
+            ++rxMarkHead;
+        }
+        return 0;
+    }
+
+    void Socket::trackTx(uint64_t rxNanoSec) {
+        if (!timestamping || rxNanoSec == 0 || streamOffset == 0) return;
+        if (txPendingTail - txPendingHead == txPendingCount) ++txPendingHead;
+        txPending[txPendingTail++ % txPendingCount] = {streamOffset - 1, rxNanoSec};
+    }
+
+    void Socket::readErrorQueue() {
+        if (!timestamping) return;
+        char control[CMSG_SPACE(sizeof(scm_timestamping)) + CMSG_SPACE(sizeof(sock_extended_err) + 64)];
+        msghdr message{};
+        while (true) {
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            if (::recvmsg(socket, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+            const scm_timestamping *stamps = nullptr;
+            const sock_extended_err *error = nullptr;
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                    stamps = reinterpret_cast<const scm_timestamping *>(CMSG_DATA(cmsg));
+                } else if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                           (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                    error = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cmsg));
+                }
+            }
+            if (stamps == nullptr || error == nullptr || error->ee_origin != SO_EE_ORIGIN_TIMESTAMPING) continue;
+            uint64_t txNanoSec = pickTimestamp(stamps);
+            // ee_data is the 32 bit offset of the last byte of the stamped send
+            while (txPendingHead != txPendingTail) {
+                TxPending &pending = txPending[txPendingHead % txPendingCount];
+                if ((int32_t) (error->ee_data - (uint32_t) pending.lastByte) < 0) break;
+                if (wireLatencyCount < wireLatencyCapacity && txNanoSec > pending.rxNanoSec) {
+                    wireLatencies[wireLatencyCount++] = txNanoSec - pending.rxNanoSec;
+                }
+                ++txPendingHead;
+            }
+        }
     }
 
     Socket::~Socket() {
+        delete uring;
+        if (epollFd >= 0) ::close(epollFd);
         closesocket(socket);
     }
 
-    status Socket::read(char *dst, size_t count, bool returnOnNoData) {
-        if (begin != end) {
-            returnOnNoData = false;
+    bool Socket::enableUring(bool batchSubmit) {
+        Uring *ring = Uring::forThread();
+        if (ring == nullptr) return false;
+        if (batchSubmit) ring->deferSubmit = true;
+        // io_uring completes non-blocking sockets with EAGAIN instead of
+        // arming a poll, so the socket is blocking in this mode
+        int flags = ::fcntl(socket, F_GETFL);
+        ::fcntl(socket, F_SETFL, flags & ~O_NONBLOCK);
+        // both mappings of the mirrored queue, a send may cross the wrap
+        uring = ring->attach(socket, outbound.data, 2 * outbound.capacity);
+        if (uring == nullptr) ::fcntl(socket, F_SETFL, flags);
+        return uring != nullptr;
+    }
+
+    ssize_t Socket::receive() {
+        if (ring.space() == 0) {
+            errno = ENOBUFS;
+            return -1;
         }
-        while (begin != end && count > 0) {
-            *dst++ = *begin++;
-            --count;
+        if (uring != nullptr) {
+            if (pendingBegin == pendingEnd) {
+                ssize_t cntReadBytes = uring->receive(pendingBegin, pendingEnd);
+                if (cntReadBytes <= 0) return cntReadBytes;
+            }
+            size_t cnt = std::min(ring.space(), (size_t) (pendingEnd - pendingBegin));
+            memcpy(ring.writePtr(), pendingBegin, cnt);
+            pendingBegin += cnt;
+            ring.produce(cnt);
+            lastReceiveTicks = tscTicks();
+            return (ssize_t) cnt;
         }
-        if (count == 0) return success;
-        while (count > 0) {
-            ssize_t cntReadBytes = recv(socket, readBuffer, sizeof(readBuffer) - 8, 0);
-            if (cntReadBytes < 0 && (socketerrno == SOCKET_EWOULDBLOCK || socketerrno == SOCKET_EAGAIN_EINPROGRESS)) {
-                if (returnOnNoData) return noData;
-                if (waitOnSocket) {
+        ssize_t cntReadBytes = timestamping ? receiveTimestamped(ring.writePtr(), ring.space())
+                                            : recv(socket, ring.writePtr(), ring.space(), 0);
+        if (cntReadBytes > 0) {
+            ring.produce(cntReadBytes);
+            lastReceiveTicks = tscTicks();
+        }
+        return cntReadBytes;
+    }
+
+    int Socket::pollFd() {
+        return uring != nullptr ? uring->pollFd() : socket;
+    }
+
+    bool enableEpollBusyPoll(int epollFd, int microSec) {
+        epoll_params params{};
+        params.busy_poll_usecs = microSec;
+        params.busy_poll_budget = 8;
+        params.prefer_busy_poll = 1;
+        if (::ioctl(epollFd, EPIOCSPARAMS, &params) == 0) return true;
+        int sysctl = 0;
+        if (FILE *file = fopen("/proc/sys/net/core/busy_poll", "r")) {
+            if (fscanf(file, "%d", &sysctl) != 1) sysctl = 0;
+            fclose(file);
+        }
+        static bool warned = false;
+        if (sysctl == 0 && !warned) {
+            warned = true;
+            fprintf(stderr, "busy poll: no EPIOCSPARAMS and net.core.busy_poll=0, epoll_wait will not spin\n");
+        }
+        return sysctl != 0;
+    }
+
+    void Socket::enableBusyPoll(int microSec) {
+        // the socket options cover blocking recv/poll on this socket, the
+        // epoll set of block() is configured when it is created
+        int preferBusyPoll = 1;
+        ::setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &microSec, sizeof(microSec));
+        ::setsockopt(socket, SOL_SOCKET, SO_PREFER_BUSY_POLL, &preferBusyPoll, sizeof(preferBusyPoll));
+        busyPollMicroSec = microSec;
+    }
+
+    void Socket::block() {
+        if (uring != nullptr) {
+            uring->wait();
+            return;
+        }
+        bool wantsWrite = outbound.size() != 0;
+        if (epollFd < 0 || wantsWrite != epollWantsWrite) {
+            int op = epollFd < 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+            if (epollFd < 0) {
+                epollFd = epoll_create1(EPOLL_CLOEXEC);
+                if (busyPollMicroSec > 0) enableEpollBusyPoll(epollFd, busyPollMicroSec);
+            }
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP | (wantsWrite ? (uint32_t) EPOLLOUT : 0u);
+            epoll_ctl(epollFd, op, socket, &event);
+            epollWantsWrite = wantsWrite;
+        }
+        epoll_event event{};
+        epoll_wait(epollFd, &event, 1, -1);
+    }
+
+    status Socket::fill(bool returnOnNoData) {
+        uint64_t *tier = &waitStats.immediate;
+        int spins = 0;
+        while (true) {
+            // a non-empty error queue keeps the socket signalled, drain it before waiting
+            readErrorQueue();
+            if (outbound.size() != 0 && flushOutbound() == closed) {
+                socketClosed = true;
+                return closed;
+            }
+            ssize_t cntReadBytes = receive();
+            if (cntReadBytes > 0) {
+                ++*tier;
+                return success;
+            }
+            if (cntReadBytes == 0 ||
+                (socketerrno != SOCKET_EWOULDBLOCK && socketerrno != SOCKET_EAGAIN_EINPROGRESS)) {
+                socketClosed = true;
+                return closed;
+            }
+            if (returnOnNoData) return noData;
+            // nothing may sit in a batched submission while this thread waits
+            if (uring != nullptr) uring->ring->submit();
+            switch (wait) {
+                case sleepWait:
+                    tier = &waitStats.sleep;
+                    std::this_thread::sleep_for(std::chrono::microseconds(1));
+                    break;
+                case selectWait: {
+                    tier = &waitStats.block;
+                    if (uring != nullptr) {
+                        block();
+                        break;
+                    }
                     fd_set rfds;
-                    timeval tv = {0, rand()%1000000};
+                    fd_set wfds;
+                    timeval tv = {0, rand() % 1000000};
                     FD_ZERO(&rfds);
+                    FD_ZERO(&wfds);
                     FD_SET(socket, &rfds);
-                    select(socket + 1, &rfds, nullptr, 0, &tv);
-                } else {
-                    std::this_thread::sleep_for(std::chrono::microseconds(1));
+                    if (outbound.size() != 0) FD_SET(socket, &wfds);
+                    select(socket + 1, &rfds, &wfds, 0, &tv);
+                    break;
                 }
-                continue;
-            } else if (cntReadBytes <= 0) {
-                socketClosed = true;
-                return closed;
-            }
-            begin = readBuffer;
-            end = begin + cntReadBytes;
-            while (begin != end && count > 0) {
-                *dst++ = *begin++;
-                --count;
+                case spinWait:
+                    tier = &waitStats.spin;
+                    _mm_pause();
+                    break;
+                case spinThenBlock:
+                    if (spins++ < spinLimit) {
+                        tier = &waitStats.spin;
+                        _mm_pause();
+                    } else {
+                        tier = &waitStats.block;
+                        block();
+                    }
+                    break;
+                case busyPollWait:
+                    // epoll_wait spins on the device queue when enableEpollBusyPoll took
+                    tier = &waitStats.busyPoll;
+                    block();
+                    break;
             }
         }
-        return success;
     }
 
-    void bcopy(char *dst, const char *src, int count, uint8_t *mask, int index) {
-        if (count < 20) {
-            while (count--) {
-                *dst++ = *src++ ^ mask[(index++) & 3];
-            }
-            return;
+    status Socket::read(char *dst, size_t count, bool returnOnNoData) {
+        if (ring.size() != 0) {
+            returnOnNoData = false;
         }
-        while (index & 3) {
-            *dst++ = *src++ ^ mask[(index++) & 3];
-            count--;
+        while (true) {
+            size_t cnt = std::min(ring.size(), count);
+            memcpy(dst, ring.readPtr(), cnt);
+            consumeCopied(cnt);
+            dst += cnt;
+            count -= cnt;
+            if (count == 0) return success;
+            status st = fill(returnOnNoData);
+            if (st != success) return st;
+            returnOnNoData = false;
         }
-        uint64_t m = *(uint32_t *) mask;
-        m |= m << 32;
-        auto *d = (uint64_t *) dst;
-        auto *s = (uint64_t *) src;
-        for (; count > 0; count -= 8) {
-            *d++ = *s++ ^ m;
+    }
+
+    void Socket::consumeCopied(size_t count) {
+        // with no view handed out since the last release nothing before the
+        // copied bytes is referenced, so their space can go back to recv
+        bool nothingRetained = ring.retained == ring.head;
+        ring.consume(count);
+        if (nothingRetained) ring.release();
+    }
+
+    status Socket::view(char *&dst, size_t count) {
+        while (ring.size() < count) {
+            if (fill(false) == closed) return closed;
         }
+        dst = ring.readPtr();
+        ring.consume(count);
+        return success;
     }
 
     status Socket::read(char *dst, size_t count, uint8_t *mask) {
-        size_t cnt = std::min((size_t) (end - begin), count);
-        bcopy(dst, begin, cnt, mask, 0);
-        count -= cnt;
-        dst += cnt;
-        begin += cnt;
-        if (count == 0) return success;
-        int index = cnt & 3;
-        while (count > 0) {
-            ssize_t cntReadBytes = recv(socket, readBuffer, sizeof(readBuffer) - 8, 0);
-            if (cntReadBytes < 0 && (socketerrno == SOCKET_EWOULDBLOCK || socketerrno == SOCKET_EAGAIN_EINPROGRESS)) {
-                //TODO wait for data and PING if there's no data
-                continue;
-            } else if (cntReadBytes <= 0) {
-                socketClosed = true;
-                return closed;
-            }
-            begin = readBuffer;
-            end = begin + cntReadBytes;
-            cnt = std::min((size_t) (end - begin), count);
-            bcopy(dst, begin, cnt, mask, index);
+        int index = 0;
+        while (true) {
+            size_t cnt = std::min(ring.size(), count);
+            maskCopy(dst, ring.readPtr(), cnt, mask, index);
+            consumeCopied(cnt);
             index += cnt;
-            count -= cnt;
             dst += cnt;
-            begin += cnt;
+            count -= cnt;
+            if (count == 0) return success;
+            //TODO PING if there's no data for too long
+            if (fill(false) == closed) return closed;
+        }
+    }
+
+    size_t Socket::sink(const char *src, size_t count) {
+        // the outbound queue stays empty, its buffer is only a copy target
+        for (size_t offset = 0; offset < count; offset += outbound.capacity) {
+            memcpy(outbound.writePtr(), src + offset, std::min(count - offset, outbound.capacity));
+        }
+        return count;
+    }
+
+    ssize_t Socket::sendSome(const char *src, size_t count) {
+        if (memorySink) return (ssize_t) sink(src, count);
+        ssize_t ret = ::send(socket, src, count, MSG_DONTWAIT);
+        if (ret < 0 && (socketerrno == SOCKET_EWOULDBLOCK || socketerrno == SOCKET_EAGAIN_EINPROGRESS)) {
+            return 0;
+        }
+        return ret <= 0 && count > 0 ? -1 : ret;
+    }
+
+    status Socket::flushOutbound() {
+        if (uring != nullptr) {
+            ssize_t sent = uring->takeSent();
+            if (sent < 0) return closed;
+            outbound.consume(sent);
+            outbound.release();
+            if (!uring->sendInFlight() && outbound.size() != 0 && !uring->send(outbound.readPtr(), outbound.size())) {
+                return closed;
+            }
+            return success;
+        }
+        while (outbound.size() > 0) {
+            ssize_t ret = sendSome(outbound.readPtr(), outbound.size());
+            if (ret < 0) return closed;
+            if (ret == 0) break;
+            outbound.consume(ret);
+            outbound.release();
         }
         return success;
     }
 
+    status Socket::park(const char *src, size_t count) {
+        ++sendStats.parked;
+        return enqueue(src, count);
+    }
+
+    status Socket::enqueue(const char *src, size_t count) {
+        if (outbound.space() < count) {
+            // the queue is full as well: stall until the kernel drains it
+            ++sendStats.blocked;
+            uint64_t start = tscTicks();
+            while (outbound.space() < count) {
+                if (flushOutbound() == closed) return closed;
+                if (outbound.space() < count && uring != nullptr) {
+                    uring->wait();
+                } else if (outbound.space() < count) {
+                    pollfd fd{socket, POLLOUT, 0};
+                    ::poll(&fd, 1, 1);
+                }
+            }
+            sendStats.blockedNanoSec += ticksToNanoSec(tscTicks() - start);
+        }
+        memcpy(outbound.writePtr(), src, count);
+        outbound.produce(count);
+        sendStats.maxDepth = std::max<uint64_t>(sendStats.maxDepth, outbound.size());
+        return success;
+    }
+
     status Socket::write(const char *src, int count) {
-        while (count > 0) {
-            int ret = ::send(socket, src, count, 0);
+        streamOffset += count;
+        if (uring != nullptr) {
+            // a send still in flight means these bytes wait behind it
+            if (uring->sendInFlight()) ++sendStats.parked;
+            if (enqueue(src, count) == closed) return closed;
+            return flushOutbound();
+        }
+        // queued bytes go first; once they are out the new ones needn't wait
+        if (outbound.size() != 0 && flushOutbound() == closed) return closed;
+        if (outbound.size() == 0) {
+            ssize_t ret = sendSome(src, count);
+            if (ret < 0) return closed;
+            src += ret;
+            count -= (int) ret;
+            if (count == 0) return success;
+        }
+        return park(src, count);
+    }
+
+    status Socket::write(iovec *parts, int count) {
+        msghdr message{};
+        message.msg_iov = parts;
+        message.msg_iovlen = count;
+        for (int i = 0; i < count; ++i) streamOffset += parts[i].iov_len;
+        if (memorySink) {
+            for (int i = 0; i < count; ++i) sink(static_cast<const char *>(parts[i].iov_base), parts[i].iov_len);
+            return success;
+        }
+        if (uring != nullptr) {
+            if (uring->sendInFlight()) ++sendStats.parked;
+            for (int i = 0; i < count; ++i) {
+                if (enqueue(static_cast<const char *>(parts[i].iov_base), parts[i].iov_len) == closed) return closed;
+            }
+            return flushOutbound();
+        }
+        if (outbound.size() != 0 && flushOutbound() == closed) return closed;
+        if (outbound.size() == 0) {
+            ssize_t ret = ::sendmsg(socket, &message, MSG_DONTWAIT);
             if (ret < 0 && (socketerrno == SOCKET_EWOULDBLOCK || socketerrno == SOCKET_EAGAIN_EINPROGRESS)) {
-                continue;
+                ret = 0;
             } else if (ret <= 0) {
                 return closed;
             }
-            count -= ret;
-            src += ret;
+            while (message.msg_iovlen > 0 && (size_t) ret >= message.msg_iov->iov_len) {
+                ret -= (ssize_t) message.msg_iov->iov_len;
+                ++message.msg_iov;
+                --message.msg_iovlen;
+            }
+            if (message.msg_iovlen > 0) {
+                message.msg_iov->iov_base = static_cast<char *>(message.msg_iov->iov_base) + ret;
+                message.msg_iov->iov_len -= ret;
+            }
+        }
+        for (size_t i = 0; i < message.msg_iovlen; ++i) {
+            if (park(static_cast<const char *>(message.msg_iov[i].iov_base), message.msg_iov[i].iov_len) == closed) {
+                return closed;
+            }
         }
         return success;
     }
 
     WebSocket::WebSocket(const std::string &hostname, int port, const std::string &path, bool useMask,
-                         bool waitOnSocket)
-            : socket(hostname, port, waitOnSocket), useMask(useMask) {
-        if (isClosed()) {
+                         const SocketOptions &options)
+            : socket(hostname, port, options), useMask(useMask), pendingPartCount(0),
+              pendingCount(0), corked(false) {
+        if (isClosed() || socket.memorySink) {
             return;
         }
         char buffer[4096];
@@ -159,10 +515,17 @@ namespace bhft {
         int flag = 1;
         ::setsockopt(socket.socket, IPPROTO_TCP, TCP_NODELAY, (char *) &flag,
                      sizeof(flag)); // Disable Nagle's algorithm
+        if (options.wait == busyPollWait) {
+            socket.enableBusyPoll(options.busyPollMicroSec);
+        }
         int readSize = 8192;
         int writeSize = 8192;
         //::setsockopt(socket.socket, SOL_SOCKET, SO_RCVBUF, &readSize, sizeof(readSize));
         //::setsockopt(socket.socket, SOL_SOCKET, SO_SNDBUF, &writeSize, sizeof(writeSize));
+        if (options.transport == ioUring) {
+            if (socket.enableUring(options.batchSubmit)) return;
+            fprintf(stderr, "io_uring unavailable, falling back to recv/send\n");
+        }
         ::fcntl(socket.socket, F_SETFL, O_NONBLOCK);
     }
 
@@ -181,7 +544,95 @@ namespace bhft {
     }
 
     status WebSocket::getMessage(Message &message, bool returnOnPong, bool returnOnNoData) {
+        // the previous message is no longer referenced
+        socket.ring.release();
+        return readFrames(message, returnOnPong, returnOnNoData);
+    }
+
+    status WebSocket::getMessages(MessageBatch &batch, char *buffer, size_t capacity, bool returnOnNoData) {
+        socket.ring.release();
+        batch.count = 0;
+        batch.messages[0] = Message(buffer, capacity);
+        auto st = readFrames(batch.messages[0], false, returnOnNoData);
+        if (st != success) return st;
+        batch.count = 1;
+        while (batch.count < MessageBatch::capacity && nextFrameBuffered()) {
+            Message &message = batch.messages[batch.count++];
+            message = Message(nullptr);
+            if (readFrames(message, false, false) == closed) return closed;
+        }
+        return success;
+    }
+
+    bool WebSocket::nextFrameBuffered() {
+        size_t size = socket.ring.size();
+        if (size < 2) return false;
+        const auto *data = reinterpret_cast<const uint8_t *>(socket.ring.readPtr());
+        int opcode = data[0] & 0x0f;
+        if ((data[0] & 0x80) == 0 || (data[1] & 0x80) != 0 ||
+            (opcode != wsheader_type::TEXT_FRAME && opcode != wsheader_type::BINARY_FRAME)) {
+            return false;
+        }
+        uint64_t N = data[1] & 0x7f;
+        size_t headerSize = 2;
+        if (N == 126) {
+            headerSize = 4;
+            if (size < headerSize) return false;
+            N = ((uint64_t) data[2] << 8) | data[3];
+        } else if (N == 127) {
+            headerSize = 10;
+            if (size < headerSize) return false;
+            N = 0;
+            for (int i = 2; i < 10; ++i) N = (N << 8) | data[i];
+        }
+        return N <= size - headerSize && N + 16 <= socket.ring.capacity;
+    }
+
+    // Header plus payload of the frame at data, 0 while its header is incomplete.
+    static uint64_t frameSizeAt(const uint8_t *data, size_t size) {
+        if (size < 2) return 0;
+        uint64_t N = data[1] & 0x7f;
+        size_t headerSize = (data[1] & 0x80) != 0 ? 6 : 2;
+        if (N == 126) {
+            headerSize += 2;
+            if (size < 4) return 0;
+            N = ((uint64_t) data[2] << 8) | data[3];
+        } else if (N == 127) {
+            headerSize += 8;
+            if (size < 10) return 0;
+            N = 0;
+            for (int i = 2; i < 10; ++i) N = (N << 8) | data[i];
+        }
+        return headerSize + N;
+    }
+
+    bool WebSocket::messageBuffered() {
+        size_t size = socket.ring.size();
+        const auto *data = reinterpret_cast<const uint8_t *>(socket.ring.readPtr());
+        uint64_t offset = 0;
+        while (true) {
+            uint64_t frameSize = frameSizeAt(data + offset, size - offset);
+            // a message the ring can't hold whole is read as it arrives
+            if (offset + (frameSize == 0 ? 14 : frameSize) > socket.ring.capacity) return true;
+            if (frameSize == 0 || offset + frameSize > size) return false;
+            bool fin = (data[offset] & 0x80) != 0;
+            // readFrames returns after a control frame that doesn't interrupt a message
+            bool control = (data[offset] & 0x08) != 0;
+            if ((control && offset == 0) || (!control && fin)) return true;
+            offset += frameSize;
+        }
+    }
+
+    status WebSocket::readFrames(Message &message, bool returnOnPong, bool returnOnNoData) {
         wsheader_type ws;
+        message.view = false;
+        if (returnOnNoData) {
+            // a reactor must not wait inside a message: take it once all of it is here
+            while (!messageBuffered()) {
+                auto st = socket.fill(true);
+                if (st != success) return st;
+            }
+        }
         do {
             char header[16];
             auto st = socket.read(header, 2, returnOnNoData);
@@ -238,12 +689,26 @@ namespace bhft {
                 ws.masking_key[2] = 0;
                 ws.masking_key[3] = 0;
             }
+            bool isData = ws.opcode == wsheader_type::TEXT_FRAME
+                          || ws.opcode == wsheader_type::BINARY_FRAME
+                          || ws.opcode == wsheader_type::CONTINUATION;
+            bool asView = isData && ws.fin && !ws.mask && message.begin == message.end &&
+                          ws.N + sizeof(header) <= socket.ring.capacity;
+            if (!asView && ws.N >= (uint64_t) (message.limit - message.end)) {
+                // the payload and its NUL terminator don't fit the caller's buffer
+                socket.socketClosed = true;
+                return closed;
+            }
             // We got a whole message, now do something with it:
-            if (
-                    ws.opcode == wsheader_type::TEXT_FRAME
-                    || ws.opcode == wsheader_type::BINARY_FRAME
-                    || ws.opcode == wsheader_type::CONTINUATION
-                    ) {
+            if (isData) {
+                if (asView) {
+                    // a whole unmasked message: hand out the bytes where recv put them
+                    if (socket.view(message.begin, ws.N) == closed) return closed;
+                    message.end = message.begin + ws.N;
+                    message.view = true;
+                    message.rxNanoSec = socket.rxTimestampAt(socket.ring.head);
+                    return success;
+                }
                 if (ws.mask) {
                     if (socket.read(message.end, ws.N, ws.masking_key) == closed) return closed;
                 } else {
@@ -265,35 +730,34 @@ namespace bhft {
             }
         } while (!ws.fin);
         *message.end = 0;
+        message.rxNanoSec = socket.rxTimestampAt(socket.ring.head);
         return success;
     }
 
-    status WebSocket::sendLastOutputMessage(wsheader_type::opcode_type type) {
-        const uint8_t masking_key[4] = {0x12, 0x34, 0x56, 0x78};
-        //const uint8_t masking_key[4] = {0, 0, 0, 0};
-        // TODO: consider acquiring a lock on txbuf...
-        size_t messageSize = outputMessage.end - outputMessage.begin;
+    const uint8_t WebSocket::maskingKey[4] = {0x12, 0x34, 0x56, 0x78};
+    //const uint8_t WebSocket::maskingKey[4] = {0, 0, 0, 0};
 
+    int WebSocket::writeHeader(wsheader_type::opcode_type type, char *payload, size_t messageSize) {
         int headerSize = 2 + (messageSize >= 126 ? 2 : 0) + (messageSize >= 65536 ? 6 : 0) + (useMask ? 4 : 0);
-        auto *header = reinterpret_cast<uint8_t *>(outputMessage.begin - headerSize);
+        auto *header = reinterpret_cast<uint8_t *>(payload - headerSize);
         header[0] = 0x80 | type;
         if (messageSize < 126) {
             header[1] = (messageSize & 0xff) | (useMask ? 0x80 : 0);
             if (useMask) {
-                header[2] = masking_key[0];
-                header[3] = masking_key[1];
-                header[4] = masking_key[2];
-                header[5] = masking_key[3];
+                header[2] = maskingKey[0];
+                header[3] = maskingKey[1];
+                header[4] = maskingKey[2];
+                header[5] = maskingKey[3];
             }
         } else if (messageSize < 65536) {
             header[1] = 126 | (useMask ? 0x80 : 0);
             header[2] = (messageSize >> 8) & 0xff;
             header[3] = (messageSize >> 0) & 0xff;
             if (useMask) {
-                header[4] = masking_key[0];
-                header[5] = masking_key[1];
-                header[6] = masking_key[2];
-                header[7] = masking_key[3];
+                header[4] = maskingKey[0];
+                header[5] = maskingKey[1];
+                header[6] = maskingKey[2];
+                header[7] = maskingKey[3];
             }
         } else { // TODO: run coverage testing here
             header[1] = 127 | (useMask ? 0x80 : 0);
@@ -306,28 +770,96 @@ namespace bhft {
             header[8] = (messageSize >> 8) & 0xff;
             header[9] = (messageSize >> 0) & 0xff;
             if (useMask) {
-                header[10] = masking_key[0];
-                header[11] = masking_key[1];
-                header[12] = masking_key[2];
-                header[13] = masking_key[3];
+                header[10] = maskingKey[0];
+                header[11] = maskingKey[1];
+                header[12] = maskingKey[2];
+                header[13] = maskingKey[3];
             }
         }
+        return headerSize;
+    }
+
+    status WebSocket::sendLastOutputMessage(wsheader_type::opcode_type type) {
+        // TODO: consider acquiring a lock on txbuf...
+        OutputMessage &outputMessage = outputMessages[pendingCount];
+        size_t messageSize = outputMessage.end - outputMessage.begin;
+        int headerSize = writeHeader(type, outputMessage.begin, messageSize);
         // N.B. - txbuf will keep growing until it can be transmitted over the socket:
         if (useMask) {
 // could be omitted when masking key is zeros
-            auto m = *(unsigned int *) masking_key;
-            for (size_t i = 0; i < messageSize; i += sizeof(unsigned)) {
-                *(unsigned int *) (outputMessage.begin + i) ^= m;
+            maskCopy(outputMessage.begin, outputMessage.begin, messageSize, maskingKey, 0);
+        }
+        iovec frame{outputMessage.begin - headerSize, messageSize + headerSize};
+        return queueFrame(&frame, 1);
+    }
+
+    status WebSocket::sendFrame(wsheader_type::opcode_type type, const iovec *parts, int count) {
+        OutputMessage &outputMessage = getOutputMessage();
+        size_t messageSize = 0;
+        for (int i = 0; i < count; ++i) {
+            messageSize += parts[i].iov_len;
+        }
+        if (useMask) {
+            // masking has to write every byte anyway, so copy and mask in one pass
+            if (messageSize > (size_t) (outputMessage.buffer + sizeof(outputMessage.buffer) - outputMessage.begin)) {
+                return closed;
             }
+            for (int i = 0; i < count; ++i) {
+                maskCopy(outputMessage.end, static_cast<const char *>(parts[i].iov_base), parts[i].iov_len,
+                         maskingKey, outputMessage.end - outputMessage.begin);
+                outputMessage.end += parts[i].iov_len;
+            }
+            int headerSize = writeHeader(type, outputMessage.begin, messageSize);
+            iovec frame{outputMessage.begin - headerSize, messageSize + headerSize};
+            return queueFrame(&frame, 1);
+        }
+        if (count > maxFrameParts) return closed;
+        int headerSize = writeHeader(type, outputMessage.begin, messageSize);
+        iovec frame[maxFrameParts + 1];
+        frame[0] = {outputMessage.begin - headerSize, (size_t) headerSize};
+        memcpy(frame + 1, parts, count * sizeof(iovec));
+        return queueFrame(frame, count + 1);
+    }
+
+    status WebSocket::queueFrame(const iovec *parts, int count) {
+        memcpy(pendingParts + pendingPartCount, parts, count * sizeof(iovec));
+        pendingPartCount += count;
+        ++pendingCount;
+        if (corked && pendingCount < outputSlots) {
+            return success;
+        }
+        return sendPending();
+    }
+
+    void WebSocket::cork() {
+        corked = true;
+    }
+
+    status WebSocket::flush() {
+        corked = false;
+        return sendPending();
+    }
 
+    status WebSocket::sendPending() {
+        int count = pendingPartCount;
+        pendingCount = 0;
+        pendingPartCount = 0;
+        if (count == 1) {
+            return socket.write(static_cast<const char *>(pendingParts[0].iov_base), (int) pendingParts[0].iov_len);
         }
-        return socket.write(reinterpret_cast<const char *>(header), messageSize + headerSize);
+        return count == 0 ? success : socket.write(pendingParts, count);
     }
 
     OutputMessage &WebSocket::getOutputMessage() {
+        OutputMessage &outputMessage = outputMessages[pendingCount];
         outputMessage.reset();
         return outputMessage;
     }
 
-    Message::Message(char *begin) : begin(begin), end(begin) {}
+    Message::Message() : Message(nullptr) {}
+
+    Message::Message(char *begin) : Message(begin, 0) {}
+
+    Message::Message(char *begin, size_t capacity) : begin(begin), end(begin), view(false), rxNanoSec(0),
+                                                     limit(begin + capacity) {}
 } // bhft
\ No newline at end of file
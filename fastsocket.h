@@ -15,6 +15,7 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <chrono>
@@ -22,6 +23,7 @@
 #include <random>
 #include <iostream>
 #include <cstring>
+#include "ringbuffer.h"
 
 #ifndef INVALID_SOCKET
 #define INVALID_SOCKET (-1)
@@ -68,27 +70,193 @@ namespace bhft {
         uint8_t masking_key[4];
     };
 
+    struct UringConnection;
+
+    enum transportType {
+        syscalls,
+        ioUring,
+        // no connection: sends are copied into the outbound buffer and
+        // dropped, for driving the pipeline offline
+        inMemory
+    };
+
+    // What Socket::read does while the socket has no data.
+    enum waitPolicy {
+        sleepWait,      // 1us sleep between recv attempts
+        selectWait,     // select() with a random timeout up to a second
+        spinWait,       // retry recv with _mm_pause in between
+        spinThenBlock,  // spin spinLimit times, then epoll_wait
+        busyPollWait    // epoll_wait on an epoll set configured to busy poll, see enableEpollBusyPoll
+    };
+
+    // How each wait for data ended: data that was already there, or the tier
+    // that was active when it arrived.
+    struct WaitStats {
+        uint64_t immediate = 0;
+        uint64_t spin = 0;
+        uint64_t sleep = 0;
+        uint64_t block = 0;
+        uint64_t busyPoll = 0;
+    };
+
+    // Outbound queue counters: writes that had to be parked, the deepest the
+    // queue got and how long writers were stalled on a full queue.
+    struct SendStats {
+        uint64_t parked = 0;
+        uint64_t maxDepth = 0;
+        uint64_t blocked = 0;
+        uint64_t blockedNanoSec = 0;
+    };
+
+    // Makes epoll_wait on epollFd spin on the device queue for up to microSec
+    // before sleeping (EPIOCSPARAMS, kernel 6.9+). Older kernels only busy
+    // poll in epoll_wait with the net.core.busy_poll sysctl set; false when
+    // neither is in effect. Sockets in the set should share a NAPI id.
+    bool enableEpollBusyPoll(int epollFd, int microSec);
+
+    struct SocketOptions {
+        waitPolicy wait = sleepWait;
+        int spinLimit = 10000;
+        int busyPollMicroSec = 50;
+        size_t ringSize = 1 << 20;
+        size_t outboundSize = 256 << 10;
+        // kernel rx/tx timestamps (SO_TIMESTAMPING), rx needs the syscall transport
+        bool timestamping = false;
+        transportType transport = syscalls;
+        // io_uring sends wait for Uring::submitForThread(), for a reactor
+        // thread that submits once per pass over its connections
+        bool batchSubmit = false;
+    };
+
     struct Socket {
-        char readBuffer[1508];
-        char *begin;
-        char *end;
+        MirroredBuffer ring;
+        // io_uring data that didn't fit into the ring yet
+        char *pendingBegin;
+        char *pendingEnd;
         socket_t socket;
         bool socketClosed;
-        bool waitOnSocket;
+        waitPolicy wait;
+        int spinLimit;
+        int epollFd;
+        bool epollWantsWrite;
+        WaitStats waitStats;
+        // busy poll budget for the epoll set of block(), 0 for none
+        int busyPollMicroSec = 0;
+        // tscTicks() when the last bytes were received
+        uint64_t lastReceiveTicks = 0;
+
+        // Kernel timestamps, CLOCK_REALTIME nanoseconds. Every recv leaves a
+        // mark with the ring offset it filled up to, so a frame gets the
+        // timestamp of the segment that completed it. Every send advances
+        // streamOffset, which is what the kernel reports in the error queue
+        // to say which byte a tx timestamp belongs to.
+        struct RxMark {
+            uint64_t end;
+            uint64_t nanoSec;
+        };
+        struct TxPending {
+            uint64_t lastByte;
+            uint64_t rxNanoSec;
+        };
+        static const int rxMarkCount = 64;
+        static const int txPendingCount = 1024;
+        static const int wireLatencyCapacity = 256;
+        bool timestamping = false;
+        RxMark rxMarks[rxMarkCount];
+        uint64_t rxMarkHead = 0;
+        uint64_t rxMarkTail = 0;
+        uint64_t streamOffset = 0;
+        TxPending txPending[txPendingCount];
+        uint64_t txPendingHead = 0;
+        uint64_t txPendingTail = 0;
+        // rx to tx of tracked sends, collected from the error queue until the owner takes them
+        uint64_t wireLatencies[wireLatencyCapacity];
+        int wireLatencyCount = 0;
+        // bytes the kernel didn't take yet, sent before anything newer
+        MirroredBuffer outbound;
+        SendStats sendStats;
+        UringConnection *uring;
+        bool memorySink;
 
         status read(char *dst, size_t count, bool returnOnNoData);
 
+        // Sends what the kernel takes right now and queues the rest, only
+        // stalls when the outbound queue is full.
         status write(const char *src, int count);
 
+        // Same for a gather list; parts is used as scratch.
+        status write(iovec *parts, int count);
+
+        // memorySink transport: what a send would have copied to the kernel.
+        size_t sink(const char *src, size_t count);
+
+        // Sends as much of the outbound queue as the kernel takes.
+        status flushOutbound();
+
+        // Kernel receive timestamp of the bytes up to ring offset end, 0 if unknown.
+        uint64_t rxTimestampAt(uint64_t end);
+
+        // Everything written so far answers a message received at rxNanoSec;
+        // its tx timestamp turns into a wireLatencies entry.
+        void trackTx(uint64_t rxNanoSec);
+
+        // Matches tx timestamps waiting in the error queue with tracked sends.
+        void readErrorQueue();
+
+        // Output waiting for the socket to become writable. io_uring sends
+        // wait in the kernel and report on the completion ring instead.
+        bool hasPendingOutput() {
+            return uring == nullptr && outbound.size() != 0;
+        }
+
         ~Socket();
 
-        Socket(const std::string &hostname, int port, bool waitOnSocket);
+        Socket(const std::string &hostname, int port, const SocketOptions &options);
+
+        // Switches receive and send to the calling thread's io_uring, sends
+        // go out of the outbound queue, which is registered as a fixed buffer.
+        bool enableUring(bool batchSubmit);
+
+        ssize_t receive();
+
+        // Descriptor that becomes readable when receive() has data: the socket
+        // itself, or the completion ring in io_uring mode.
+        int pollFd();
+
+        // Receives the next chunk into [begin, end), waiting according to the
+        // wait policy unless returnOnNoData is set.
+        status fill(bool returnOnNoData);
+
+        void block();
+
+        void enableBusyPoll(int busyPollMicroSec);
+
+        bool enableTimestamping();
+
+        ssize_t receiveTimestamped(char *dst, size_t count);
+
+        // bytes sent, 0 when the kernel buffer is full, -1 on error
+        ssize_t sendSome(const char *src, size_t count);
+
+        status park(const char *src, size_t count);
+
+        // Appends to the outbound queue, stalling while it is full.
+        status enqueue(const char *src, size_t count);
 
         bool isClosed() {
             return socketClosed;
         }
 
         status read(char *dst, size_t count, uint8_t *mask);
+
+        // Makes the next count bytes available in place. The pointer stays valid
+        // until ring.release(); count must fit into the ring.
+        status view(char *&dst, size_t count);
+
+    private:
+        // Consumes bytes that were copied out of the ring and releases them
+        // unless a view still holds the ring.
+        void consumeCopied(size_t count);
     };
 
     struct OutputMessage {
@@ -121,17 +289,50 @@ namespace bhft {
     struct Message{
         char* begin;
         char* end;
-
+        // points into the socket ring instead of the caller's buffer, so it is
+        // not NUL terminated and the bytes around it belong to other frames
+        bool view;
+        // kernel receive timestamp when the socket has timestamping on, else 0
+        uint64_t rxNanoSec;
+        // end of the buffer payloads are copied to; a frame that doesn't fit
+        // with its NUL terminator closes the socket
+        char* limit;
+
+        Message();
+
+        // No room to copy into: for views and messages assembled by hand.
         explicit Message(char *begin);
 
+        Message(char *begin, size_t capacity);
+
+    };
+
+    // Frames that were already complete in the receive buffer, decoded in one
+    // pass. Every message after the first is a view.
+    struct MessageBatch {
+        static const int capacity = 32;
+        Message messages[capacity];
+        int count = 0;
     };
 
     struct WebSocket {
+        static const int outputSlots = 16;
+        static const int maxFrameParts = 31;
+        // a full set of slots always fits, so queueing never has to flush early
+        static const int maxPendingParts = outputSlots * (maxFrameParts + 1);
+        static const uint8_t maskingKey[4];
+
         Socket socket;
         bool useMask;
-        OutputMessage outputMessage;
+        // frames queued while corked occupy consecutive slots
+        OutputMessage outputMessages[outputSlots];
+        iovec pendingParts[maxPendingParts];
+        int pendingPartCount;
+        int pendingCount;
+        bool corked;
 
-        explicit WebSocket(const std::string &hostname, int port, const std::string &path, bool useMask, bool waitOnSocket);
+        explicit WebSocket(const std::string &hostname, int port, const std::string &path, bool useMask,
+                           const SocketOptions &options);
 
         status readLine(char *buffer);
 
@@ -139,11 +340,47 @@ namespace bhft {
             return socket.isClosed();
         }
 
+        // With returnOnNoData, noData until the whole message has arrived; nothing
+        // is consumed before that.
         status getMessage(Message& message, bool returnOnPong = false, bool returnOnNoData = false);
 
+        // Decodes the next message into batch.messages[0] (copying into the
+        // capacity bytes at buffer when it can't be a view), then every further
+        // data frame that is already complete in the receive buffer.
+        status getMessages(MessageBatch &batch, char *buffer, size_t capacity, bool returnOnNoData = false);
+
         OutputMessage &getOutputMessage();
 
         status sendLastOutputMessage(wsheader_type::opcode_type type);
+
+        // Sends parts as the payload of one frame. Without masking the parts
+        // go to sendmsg as they are and must stay valid until the frame is
+        // flushed; with masking they are masked into an output slot instead.
+        // At most maxFrameParts parts.
+        status sendFrame(wsheader_type::opcode_type type, const iovec *parts, int count);
+
+        // While corked sendLastOutputMessage only frames the message, flush()
+        // sends everything queued with one syscall.
+        void cork();
+
+        status flush();
+
+    private:
+        status readFrames(Message &message, bool returnOnPong, bool returnOnNoData);
+
+        bool nextFrameBuffered();
+
+        // True once the rest of the next message, or a control frame ahead of
+        // it, is in the ring, so readFrames won't wait. Also true when the
+        // message is too large to ever be buffered whole.
+        bool messageBuffered();
+
+        status sendPending();
+
+        status queueFrame(const iovec *parts, int count);
+
+        // Writes the frame header right before payload, returns its size.
+        int writeHeader(wsheader_type::opcode_type type, char *payload, size_t messageSize);
     };
 
 } // bhft
@@ -0,0 +1,35 @@
+#include "histogram.h"
+
+namespace bhft {
+
+    uint64_t Histogram::bucketLimit(int bucket) {
+        if (bucket < linearCount) return bucket;
+        int exponent = (bucket - linearCount) / subBucketCount + subBucketBits + 1;
+        uint64_t top = (bucket - linearCount) % subBucketCount + subBucketCount;
+        int shift = exponent - subBucketBits;
+        return ((top + 1) << shift) - 1;
+    }
+
+    uint64_t Histogram::count() const {
+        uint64_t total = 0;
+        for (auto &bucket: buckets) total += bucket.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t Histogram::percentile(double fraction) const {
+        uint64_t target = (uint64_t) (count() * fraction), seen = 0;
+        for (int i = 0; i < bucketCount; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen > target) return bucketLimit(i);
+        }
+        return max();
+    }
+
+    uint64_t Histogram::max() const {
+        for (int i = bucketCount - 1; i >= 0; --i) {
+            if (buckets[i].load(std::memory_order_relaxed) != 0) return bucketLimit(i);
+        }
+        return 0;
+    }
+
+} // bhft
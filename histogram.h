@@ -0,0 +1,53 @@
+#ifndef HFT_FRAMEWORK_USERDATA_HISTOGRAM_H
+#define HFT_FRAMEWORK_USERDATA_HISTOGRAM_H
+
+#include <stdint.h>
+#include <atomic>
+
+namespace bhft {
+
+    // Log-linear (HDR style) histogram of nanosecond values: exact below 64,
+    // then 32 buckets per power of two, about 3% precision up to ~39 hours.
+    // Counters are atomics so another thread can read them at any time;
+    // record() is for a single writer and costs no locked instruction,
+    // recordShared() is for counters several threads update.
+    struct Histogram {
+        static const int subBucketBits = 5;
+        static const int subBucketCount = 1 << subBucketBits;
+        static const int linearCount = 2 * subBucketCount;
+        static const int bucketCount = linearCount + (47 - subBucketBits) * subBucketCount;
+
+        std::atomic<uint64_t> buckets[bucketCount] = {};
+
+        static int bucketOf(uint64_t value) {
+            if (value < (uint64_t) linearCount) return (int) value;
+            int exponent = 63 - __builtin_clzll(value);
+            int shift = exponent - subBucketBits;
+            int index = linearCount + (exponent - subBucketBits - 1) * subBucketCount +
+                        (int) (value >> shift) - subBucketCount;
+            return index < bucketCount ? index : bucketCount - 1;
+        }
+
+        // largest value that lands in bucket
+        static uint64_t bucketLimit(int bucket);
+
+        void record(uint64_t value) {
+            auto &counter = buckets[bucketOf(value)];
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        void recordShared(uint64_t value) {
+            buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint64_t count() const;
+
+        // upper bound of the bucket holding the given fraction of samples
+        uint64_t percentile(double fraction) const;
+
+        uint64_t max() const;
+    };
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_HISTOGRAM_H
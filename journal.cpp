@@ -0,0 +1,131 @@
+#include "journal.h"
+#include "tscclock.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <chrono>
+
+namespace bhft {
+
+    static size_t align8(size_t size) {
+        return (size + 7) & ~(size_t) 7;
+    }
+
+    bool Journal::open(const std::string &journalPrefix, int journalSlot, size_t size) {
+        prefix = journalPrefix;
+        slot = journalSlot;
+        segmentSize = size;
+        active = createSegment();
+        position = sizeof(FileHeader);
+        return active != nullptr;
+    }
+
+    Journal::Segment *Journal::createSegment() {
+        std::string path = prefix + "." + std::to_string(slot) + "." + std::to_string(nextSegment) + ".journal";
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror(path.c_str());
+            return nullptr;
+        }
+        // allocate the blocks now so appends never fault on a sparse file
+        if (posix_fallocate(fd, 0, segmentSize) != 0 && ftruncate(fd, segmentSize) != 0) {
+            perror("journal size");
+            ::close(fd);
+            return nullptr;
+        }
+        void *data = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror("journal mmap");
+            ::close(fd);
+            return nullptr;
+        }
+        auto *header = static_cast<FileHeader *>(data);
+        memcpy(header->magic, "BHFTJRNL", 8);
+        header->version = version;
+        header->slot = slot;
+        header->segment = nextSegment++;
+        header->ticksPerNanoSec = tscClock.ticksPerNanoSec;
+        header->baseTicks = tscClock.baseTicks;
+        header->baseWallNanoSec = tscClock.baseWallNanoSec;
+        auto *segment = new Segment;
+        segment->data = static_cast<char *>(data);
+        segment->size = segmentSize;
+        segment->fd = fd;
+        return segment;
+    }
+
+    void Journal::closeSegment(Segment *segment) {
+        munmap(segment->data, segment->size);
+        // the zero tail past the last record is not needed any more
+        if (ftruncate(segment->fd, segment->used) != 0) perror("journal truncate");
+        ::close(segment->fd);
+        delete segment;
+    }
+
+    void Journal::append(int connectionId, uint64_t receiveTicks, uint64_t rxNanoSec, const char *data,
+                         size_t length) {
+        size_t size = sizeof(RecordHeader) + align8(length);
+        if (active == nullptr || position + size + sizeof(uint32_t) > active->size) {
+            Segment *next = spare.load(std::memory_order_acquire);
+            // the roller is behind: drop rather than stall the connection
+            if (next == nullptr || size + sizeof(FileHeader) + sizeof(uint32_t) > next->size ||
+                (active != nullptr && retired.load(std::memory_order_relaxed) != nullptr)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            spare.store(nullptr, std::memory_order_relaxed);
+            if (active != nullptr) {
+                active->used = position;
+                retired.store(active, std::memory_order_release);
+            }
+            active = next;
+            position = sizeof(FileHeader);
+        }
+        char *record = active->data + position;
+        memcpy(record + sizeof(RecordHeader), data, length);
+        auto *header = reinterpret_cast<RecordHeader *>(record);
+        header->connectionId = connectionId;
+        header->receiveTicks = receiveTicks;
+        header->rxNanoSec = rxNanoSec;
+        // length last: a reader of the live file stops at the first zero length
+        __atomic_store_n(&header->length, (uint32_t) length, __ATOMIC_RELEASE);
+        position += size;
+        records.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Journal::service() {
+        if (active == nullptr && nextSegment == 0) return;
+        if (!broken && spare.load(std::memory_order_acquire) == nullptr) {
+            Segment *segment = createSegment();
+            // out of disk or descriptors: report once, the writer drops from now on
+            broken = segment == nullptr;
+            spare.store(segment, std::memory_order_release);
+        }
+        Segment *segment = retired.load(std::memory_order_acquire);
+        if (segment != nullptr) {
+            retired.store(nullptr, std::memory_order_release);
+            closeSegment(segment);
+        }
+    }
+
+    void JournalRoller::add(Journal *journal) {
+        if (count < maxJournals) journals[count++] = journal;
+    }
+
+    void JournalRoller::start() {
+        running = true;
+        thread = std::thread([this]() {
+            while (running.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < count; ++i) journals[i]->service();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+
+    void JournalRoller::stop() {
+        if (running.exchange(false)) thread.join();
+    }
+
+} // bhft
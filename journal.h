@@ -0,0 +1,92 @@
+#ifndef HFT_FRAMEWORK_USERDATA_JOURNAL_H
+#define HFT_FRAMEWORK_USERDATA_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace bhft {
+
+    // Append-only capture of inbound frames for one connection thread, in
+    // memory-mapped segment files <prefix>.<slot>.<segment>.journal. The
+    // writer only copies into the mapping; creating, sizing and prefaulting
+    // the next segment and closing full ones is the JournalRoller's job.
+    // A segment is a FileHeader followed by records, each a RecordHeader and
+    // the frame padded to 8 bytes; a zero length marks the end.
+    struct Journal {
+        static const uint32_t version = 1;
+
+        struct FileHeader {
+            char magic[8];
+            uint32_t version;
+            int32_t slot;
+            uint64_t segment;
+            // to turn receiveTicks into wall clock nanoseconds offline
+            double ticksPerNanoSec;
+            uint64_t baseTicks;
+            uint64_t baseWallNanoSec;
+        };
+
+        struct RecordHeader {
+            uint32_t length;
+            int32_t connectionId;
+            uint64_t receiveTicks;
+            // kernel receive timestamp, 0 without timestamping
+            uint64_t rxNanoSec;
+        };
+
+        struct Segment {
+            char *data = nullptr;
+            size_t size = 0;
+            size_t used = 0;
+            int fd = -1;
+        };
+
+        std::string prefix;
+        int slot = 0;
+        size_t segmentSize = 0;
+        uint64_t nextSegment = 0;
+        bool broken = false;
+        // writer side
+        Segment *active = nullptr;
+        size_t position = 0;
+        // handed between writer and roller
+        std::atomic<Segment *> spare{nullptr};
+        std::atomic<Segment *> retired{nullptr};
+        std::atomic<uint64_t> records{0};
+        std::atomic<uint64_t> dropped{0};
+
+        // Maps the first segment right away, the rest is prepared by the roller.
+        bool open(const std::string &prefix, int slot, size_t segmentSize);
+
+        void append(int connectionId, uint64_t receiveTicks, uint64_t rxNanoSec, const char *data, size_t length);
+
+        // Roller side: keeps a spare segment ready and closes retired ones.
+        void service();
+
+    private:
+        Segment *createSegment();
+
+        void closeSegment(Segment *segment);
+    };
+
+    struct JournalRoller {
+        static const int maxJournals = 16;
+
+        Journal *journals[maxJournals] = {};
+        int count = 0;
+        std::atomic<bool> running{false};
+        std::thread thread;
+
+        void add(Journal *journal);
+
+        void start();
+
+        void stop();
+    };
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_JOURNAL_H
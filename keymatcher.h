@@ -0,0 +1,70 @@
+#ifndef HFT_FRAMEWORK_USERDATA_KEYMATCHER_H
+#define HFT_FRAMEWORK_USERDATA_KEYMATCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+
+namespace bparser {
+
+    // Field ids for a fixed key set, built at compile time: one byte of the
+    // key and its length hash to a slot of a small table, a compare against
+    // the key stored there confirms the match. No heap and no pointer
+    // chasing, the whole matcher is a few cache lines.
+    template<int N>
+    struct KeyMatcher {
+        static constexpr int tableSize = N < 4 ? 8 : N < 8 ? 16 : N < 16 ? 32 : 64;
+        static constexpr int maxLength = 255;
+
+        const char *keys[N]{};
+        uint8_t lengths[N]{};
+        int8_t table[tableSize]{};
+        uint8_t position = 0;
+        uint32_t multiplier = 0;
+        // false if no byte position and multiplier separate the keys
+        bool found = false;
+
+        constexpr explicit KeyMatcher(const char *const (&ids)[N]) {
+            for (int i = 0; i < N; ++i) {
+                keys[i] = ids[i];
+                size_t length = 0;
+                while (ids[i][length] != 0) ++length;
+                lengths[i] = (uint8_t) length;
+            }
+            for (int p = 0; p < 8 && !found; ++p) {
+                for (uint32_t m = 0x9e3779b1u; m != 0x9e3779b1u + 2 * 4096 && !found; m += 2) {
+                    position = (uint8_t) p;
+                    multiplier = m;
+                    found = fill();
+                }
+            }
+        }
+
+        constexpr int slot(const char *key, size_t length) const {
+            auto byte = (uint8_t) key[position < length ? position : length - 1];
+            return (int) (((byte ^ (uint32_t) (length << 8)) * multiplier) >> 26) & (tableSize - 1);
+        }
+
+        // -1 for keys outside the set
+        int match(const char *key, size_t length) const {
+            if (length == 0 || length > maxLength) return -1;
+            int id = table[slot(key, length)];
+            return id >= 0 && lengths[id] == length && memcmp(keys[id], key, length) == 0 ? id : -1;
+        }
+
+    private:
+        constexpr bool fill() {
+            for (auto &entry: table) entry = -1;
+            for (int i = 0; i < N; ++i) {
+                if (lengths[i] == 0) return false;
+                int8_t &entry = table[slot(keys[i], lengths[i])];
+                if (entry != -1) return false;
+                entry = (int8_t) i;
+            }
+            return true;
+        }
+    };
+
+} // bparser
+
+#endif //HFT_FRAMEWORK_USERDATA_KEYMATCHER_H
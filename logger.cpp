@@ -0,0 +1,138 @@
+#include "logger.h"
+#include "tscclock.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+
+namespace bhft {
+
+    Logger logger;
+
+    LogRing *Logger::threadRing() {
+        thread_local LogRing *ring = nullptr;
+        thread_local bool registered = false;
+        if (!registered) {
+            registered = true;
+            int index = ringCount.load(std::memory_order_relaxed);
+            while (index < maxRings &&
+                   !ringCount.compare_exchange_weak(index, index + 1, std::memory_order_relaxed)) {}
+            if (index < maxRings) {
+                ring = new LogRing;
+                __atomic_store_n(&rings[index], ring, __ATOMIC_RELEASE);
+            }
+        }
+        return ring;
+    }
+
+    void Logger::log(logEvent event, int id, uint64_t value, const char *text, size_t length) {
+        LogRing *ring = threadRing();
+        if (ring == nullptr) return;
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        size_t records = length == 0 ? 1 : (length + LogRecord::textCapacity - 1) / LogRecord::textCapacity;
+        // all or nothing, the drainer never sees half a text
+        if (LogRing::capacity - (tail - ring->head.load(std::memory_order_acquire)) < records) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        uint64_t ticks = tscTicks();
+        for (size_t i = 0; i < records; ++i) {
+            LogRecord &record = ring->records[(tail + i) % LogRing::capacity];
+            size_t offset = i * LogRecord::textCapacity;
+            record.ticks = ticks;
+            record.event = i == 0 ? event : logContinued;
+            record.id = id;
+            record.value = value;
+            record.length = std::min(length - offset, (size_t) LogRecord::textCapacity);
+            memcpy(record.text, text + offset, record.length);
+        }
+        ring->tail.store(tail + records, std::memory_order_release);
+    }
+
+    void Logger::log(logEvent event, int id, uint64_t value, const char *text) {
+        log(event, id, value, text, strlen(text));
+    }
+
+    static uint64_t wallNanoSecAt(uint64_t ticks) {
+        return tscClock.baseWallNanoSec + ticksToNanoSec(ticks - tscClock.baseTicks);
+    }
+
+    static void writeRecord(const LogRecord &record, const char *text, int length) {
+        switch (record.event) {
+            case logLogin:
+            case logSubscribe: {
+                time_t seconds = wallNanoSecAt(record.ticks) / 1000000000;
+                tm local;
+                localtime_r(&seconds, &local);
+                char date[32];
+                strftime(date, sizeof(date), "%d-%m-%Y %H:%M:%S", &local);
+                printf("%d\t%s:\t%s\t%.*s\n", record.id, record.event == logLogin ? "Login" : "Subscribe", date,
+                       length, text);
+                break;
+            }
+            case logArrived:
+                printf("%d\t%llu\tArrived: %.*s\n", record.id,
+                       (unsigned long long) (wallNanoSecAt(record.ticks) / 1000), length, text);
+                break;
+            case logSending:
+                printf("%d\tSending message:\t%.*s\n", record.id, length, text);
+                break;
+            case logReadElapsed:
+                if (record.value > 10000000) printf("BIGBIGBIGBIGBIGBIG\n");
+                else if (record.value > 10000) printf("BIG\n");
+                printf("Read message ellapsed microsec:\t%llu\n", (unsigned long long) record.value);
+                break;
+            default:
+                printf("%d\t%.*s", record.id, length, text);
+                break;
+        }
+    }
+
+    bool Logger::drain() {
+        bool any = false;
+        int count = ringCount.load(std::memory_order_relaxed);
+        for (int i = 0; i < count; ++i) {
+            LogRing *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+            if (ring == nullptr) continue;
+            uint64_t head = ring->head.load(std::memory_order_relaxed);
+            uint64_t tail = ring->tail.load(std::memory_order_acquire);
+            while (head != tail) {
+                const LogRecord &record = ring->records[head % LogRing::capacity];
+                uint64_t next = head + 1;
+                if (next != tail && ring->records[next % LogRing::capacity].event == logContinued) {
+                    joined.assign(record.text, record.length);
+                    for (; next != tail && ring->records[next % LogRing::capacity].event == logContinued; ++next) {
+                        const LogRecord &continued = ring->records[next % LogRing::capacity];
+                        joined.append(continued.text, continued.length);
+                    }
+                    writeRecord(record, joined.data(), (int) joined.size());
+                } else {
+                    writeRecord(record, record.text, record.length);
+                }
+                head = next;
+                any = true;
+            }
+            ring->head.store(head, std::memory_order_release);
+            uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+            if (dropped != 0) printf("Logger dropped %llu records\n", (unsigned long long) dropped);
+        }
+        if (any) fflush(stdout);
+        return any;
+    }
+
+    void Logger::start() {
+        running = true;
+        drainer = std::thread([this]() {
+            while (running.load(std::memory_order_relaxed)) {
+                if (!drain()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    }
+
+    void Logger::stop() {
+        if (running.exchange(false)) drainer.join();
+        drain();
+    }
+
+} // bhft
@@ -0,0 +1,77 @@
+#ifndef HFT_FRAMEWORK_USERDATA_LOGGER_H
+#define HFT_FRAMEWORK_USERDATA_LOGGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace bhft {
+
+    // What a record means; the background thread owns the text around it.
+    enum logEvent {
+        logText,
+        logLogin,
+        logSubscribe,
+        logArrived,
+        logSending,
+        logReadElapsed,
+        // more text of the record before it
+        logContinued
+    };
+
+    // Fixed size so a ring slot is written with one copy; longer text goes on
+    // in logContinued records right behind it.
+    struct LogRecord {
+        static const int textCapacity = 232;
+        uint64_t ticks;
+        uint16_t event;
+        uint16_t length;
+        int32_t id;
+        uint64_t value;
+        char text[textCapacity];
+    };
+
+    // Single producer (the thread that owns it), single consumer (the drainer).
+    struct LogRing {
+        static const uint64_t capacity = 4096;
+        LogRecord records[capacity];
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+    };
+
+    // Binary logger: producers copy a record into their own ring and never
+    // wait; a full ring drops the record and counts it. One background
+    // thread formats and writes everything to stdout.
+    struct Logger {
+        static const int maxRings = 64;
+
+        LogRing *rings[maxRings] = {};
+        std::atomic<int> ringCount{0};
+        std::atomic<bool> running{false};
+        std::thread drainer;
+        // a record's text joined with its continuations
+        std::string joined;
+
+        void start();
+
+        // Writes whatever is still queued, for use right before exit.
+        void stop();
+
+        void log(logEvent event, int id, uint64_t value, const char *text, size_t length);
+
+        void log(logEvent event, int id, uint64_t value = 0, const char *text = "");
+
+    private:
+        LogRing *threadRing();
+
+        bool drain();
+    };
+
+    extern Logger logger;
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_LOGGER_H
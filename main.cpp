@@ -9,413 +9,19 @@
 #include <map>
 #include <thread>
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include <sstream>
 #include <atomic>
 #include <iomanip>
 #include <ctime>
-#include "fastsocket.h"
-
-bool logEnabled = false;
-
-struct TimeMeasurer {
-    uint64_t currentTime;
-
-    TimeMeasurer() {
-        const auto p = std::chrono::system_clock::now();
-        currentTime = std::chrono::duration_cast<std::chrono::microseconds>(
-                p.time_since_epoch()).count();
-    }
-
-    void reset() {
-        const auto p = std::chrono::system_clock::now();
-        currentTime = std::chrono::duration_cast<std::chrono::microseconds>(
-                p.time_since_epoch()).count();
-    }
-
-    uint64_t elapsedMicroSec() {
-        const auto p = std::chrono::system_clock::now();
-        uint64_t newTime = std::chrono::duration_cast<std::chrono::microseconds>(
-                p.time_since_epoch()).count();
-        return newTime - currentTime;
-    }
-
-    uint64_t elapsedMilliSec() {
-        return elapsedMicroSec() / 1000;
-    }
-};
-
-class SpinLock {
-    const int UNLOCKED = 0;
-    const int LOCKED = 1;
-
-    std::atomic<int> m_value = 0;
-
-public:
-    void lock() {
-        while (true) {
-            int expected = UNLOCKED;
-            if (m_value.compare_exchange_strong(expected, LOCKED))
-                break;
-        }
-    }
-
-    void unlock() {
-        m_value.store(UNLOCKED);
-    }
-};
-
-struct Mutex {
-    SpinLock &spinLock;
-    TimeMeasurer timeMeasurer;
-
-    Mutex(SpinLock &spinLock) : spinLock(spinLock) {
-        spinLock.lock();
-    }
-
-    virtual ~Mutex() {
-        spinLock.unlock();
-        if (logEnabled) std::cout << "Mutex ellapsed microsec:\t" << timeMeasurer.elapsedMicroSec() << std::endl;
-    }
-};
-
-struct ThreadSync {
-    static const int dataSize = 128;
-    volatile uint64_t data[dataSize];
-    volatile int count[dataSize];
-    volatile int index;
-    SpinLock locker;
-    volatile bhft::socket_t socket[10];
-
-    int getCount(uint64_t id) {
-        for (int i = 0; i < dataSize; ++i) {
-            if (data[i] == id) return count[i]++;
-        }
-        return 0;
-    }
-
-    void add(uint64_t id) {
-        count[index] = 1;
-        data[index++] = id;
-        index %= dataSize;
-    }
-};
-
-ThreadSync threadSync;
-
-struct InputData {
-    const char *begin[7];
-    const char *end[7];
-    int mask;
-
-    void reset() {
-        mask = 0;
-    }
-
-    uint64_t getId() {
-        uint64_t id = 0;
-        const char *ordBegin = begin[0];
-        const char *ordEnd = end[0];
-        while (ordBegin != ordEnd) {
-            id *= 10;
-            id += (*ordBegin++) - '0';
-        }
-        if (begin[4][1] == 'c') id *= 10;
-        return id;
-    }
-};
-
-struct InputDataSet {
-    InputData *begin;
-    InputData *end;
-
-    InputDataSet(InputData *begin, InputData *anEnd) : begin(begin), end(anEnd) {}
-};
-
-namespace bparser {
-
-    struct state;
-    struct ObjectCallback;
-
-    struct ArrayCallback {
-
-        virtual ArrayCallback *willParseArray() = 0;
-
-        virtual ObjectCallback *willParseObject() = 0;
-
-        virtual void nextValue(const char *begin, const char *end) = 0;
-
-        virtual void arrayFinished() = 0;
-    };
-
-    struct ObjectCallback {
-        state *idMap;
-
-        explicit ObjectCallback(state *idMap) : idMap(idMap) {}
-
-        virtual void valueForField(int field_id, const char *begin, const char *end) = 0;
-
-        virtual ObjectCallback *willParseObject(int field_id) = 0;
-
-        virtual ArrayCallback *willParseArray(int field_id) = 0;
-
-        virtual void objectFinished() = 0;
-    };
-
-    struct state {
-        std::string name;
-        bool isTerminal;
-        int result;
-        state *arr[256]{};
-
-        state(
-                std::string name,
-                bool isTerminal,
-                int result,
-                state *defaultValue = nullptr)
-                : name(std::move(name)),
-                  isTerminal(
-                          isTerminal),
-                  result(result) {
-            for (auto &a: arr) {
-                a = defaultValue;
-            }
-        }
-    };
-
-    state *buildStateMachine(const char **ids, int count) {
-        auto *unknownIdState = new state("unknownIdState", false, -1);
-        auto *unknownIdFinalState = new state("unknownIdFinalState", true, -1);
-        for (int i = 0; i < 256; ++i) {
-            unknownIdState->arr[i] = (i == '"') ? unknownIdFinalState : unknownIdState;
-        }
-        auto startState = new state("startState", false, -1, unknownIdState);
-        startState->arr['"'] = unknownIdFinalState;
-        for (int i = 0; i < count; ++i) {
-            const char *ptr = *ids++;
-            auto current = startState;
-            while (*ptr != 0) {
-                if (current->arr[*ptr] == unknownIdState) {
-                    auto newNode = new state(ptr, false, -1, unknownIdState);
-                    current->arr[*ptr] = newNode;
-                    newNode->arr['"'] = unknownIdFinalState;
-                }
-                current = current->arr[*ptr];
-                ++ptr;
-            }
-            current->arr['"'] = new state("end of field", true, i);
-        }
-        return startState;
-    }
-
-    static state *unknownIds = buildStateMachine(nullptr, 0);
-
-    struct logger {
-        static bool enabled;
-        char *file;
-        int line;
-        char *begin;
-        char *current;
-        char *end;
-
-        logger(char *file, int line, char *begin, char *current, char *anEnd);
-
-
-        void operator()(const char *format, ...) {
-            if (!enabled) return;
-            std::string str(begin, end);
-            std::replace(str.begin(), str.end(), '\n', ' ');
-            std::cout << str << "\n";
-            std::cout << std::string(current - begin, ' ') << "^\n";
-
-            char buf[1024];
-            va_list args;
-            va_start(args, format);
-            vsprintf(buf, format, args);
-            va_end(args);
-            std::cout << "[" << file << ":" << line << "] " << buf << "\n";
-        }
-
-    };
-
-    bool logger::enabled = false;
-
-    logger::logger(char *file, int line, char *begin, char *current, char *anEnd) : file(file), line(line),
-                                                                                    begin(begin), current(current),
-                                                                                    end(anEnd) {}
-
-
-//#define INLOG logger(__FILE__, __LINE__, begin, current, end)
-
-
-    struct input {
-        const char *begin;
-        const char *current;
-        const char *end;
-
-        explicit input(bhft::Message &message) {
-            begin = message.begin;
-            current = message.begin;
-            end = message.end;
-        }
-
-        void log(const std::string &message) {
-            std::cout << message << ": " << *current;
-        }
-
-        static bool is_whitespace(char c) {
-            return strchr(" \t\n\r", c) != nullptr;
-        }
-
-        static bool isEndOfValue(char c) {
-            return strchr(", ]}\t\n\r", c) != nullptr;
-        }
-
-        int skipSpaces() {
-            while (current != end && is_whitespace(*current)) {
-                ++current;
-            }
-            return (current == end) ? -2 : 0;
-        }
-
-        int parseIdentifier(state *begin_state) {
-            if (skipSpaces() == -2) {
-                //INLOG("Wrong spaces");
-                return -2;
-            }
-            if (*current++ != '"') {
-                //INLOG("Not a \"");
-                return -2;
-            }
-            //INLOG("Start parsing identifier \"");
-            state *current_state = begin_state;
-            while (current != end && !current_state->isTerminal) {
-                current_state = current_state->arr[*current++];
-            }
-            if (current == end) {
-                return -2;
-            } else {
-                return current_state->result;
-            }
-        }
-
-        int parseSimpleValue() {
-            if (skipSpaces() == -2) {
-                //INLOG("Wrong spaces");
-            }
-            if (*current++ == '"') {
-                bool prevIsSlash = false;
-                while (current < end && (*current != '"' || prevIsSlash)) {
-                    if (prevIsSlash) {
-                        prevIsSlash = false;
-                    } else if (*current == '\\') {
-                        prevIsSlash = true;
-                    }
-                    ++current;
-                }
-                return current == end || *current++ != '"' ? -2 : 0;
-            } else {
-                while (current < end && !isEndOfValue(*current)) { ++current; }
-                return current == end ? -2 : 0;
-            }
-        }
-
-        [[maybe_unused]] int parseArray(ArrayCallback *arr) {
-            if (skipSpaces() == -2) {
-                //INLOG("Wrong spaces");
-                return -2;
-            }
-            if (*current++ != '[') {
-                //INLOG("Not array");
-                return -2;
-            }
-            if (skipSpaces() == -2) {
-                //INLOG("Wrong spaces");
-                return -2;
-            }
-            if (*current == ']') {
-                current++;
-                return 0;
-            }
-            do {
-                if (skipSpaces() == -2) {
-                    //INLOG("Wrong spaces");
-                    return -2;
-                }
-                if (*current == '{') {
-                    if (parseObject(arr == nullptr ? nullptr : arr->willParseObject()) == -2) return -2;
-                } else if (*current != '[') {
-                    if (parseArray(arr == nullptr ? nullptr : arr->willParseArray()) == -2) return -2;
-                } else {
-                    const char *start = current;
-                    if (parseSimpleValue() == -2) return -2;
-                    const char *finish = current;
-                    if (arr != nullptr) arr->nextValue(start, finish);
-                }
-                if (skipSpaces() == -2) {
-                    //INLOG("Wrong spaces");
-                    return -2;
-                }
-            } while (*current++ == ',');
-            if (current[-1] != ']') {
-                //INLOG("Not end of array");
-                return -2;
-            }
-            if (arr != nullptr) arr->arrayFinished();
-            return 0;
-        }
-
-        int parseObject(ObjectCallback *obj) {
-            if (skipSpaces() == -2) {
-                //INLOG("Wrong spaces");
-                return -2;
-            }
-            if (*current++ != '{') {
-                return -2;
-            }
-            if (skipSpaces() == -2) {
-                //INLOG("Wrong spaces");
-                return -2;
-            }
-            if (*current == '}') {
-                ++current;
-                return 0;
-            }
-            do {
-                if (skipSpaces() == -2) {
-                    //INLOG("Wrong spaces");
-                    return -2;
-                }
-                int id = parseIdentifier(obj == nullptr ? unknownIds : obj->idMap);
-                if (skipSpaces() == -2) {
-                    //INLOG("Wrong spaces");
-                    return -2;
-                }
-                if (*current++ != ':') return -2;
-                if (skipSpaces() == -2) {
-                    //INLOG("Wrong spaces");
-                    return -2;
-                }
-                if (*current == '{') {
-                    if (parseObject(obj == nullptr ? nullptr : obj->willParseObject(id)) == -2) return -2;
-                } else if (*current == '[') {
-                    if (parseArray(obj == nullptr ? nullptr : obj->willParseArray(id)) == -2) return -2;
-                } else {
-                    const char *start = current;
-                    if (parseSimpleValue() == -2) return -2;
-                    const char *finish = current;
-                    if (obj != nullptr) obj->valueForField(id, start, finish);
-                }
-                if (skipSpaces() == -2) {
-                    //INLOG("Wrong spaces");
-                    return -2;
-                }
-            } while (*current++ == ',');
-            if (current[-1] != '}') return -2;
-            if (obj != nullptr) obj->objectFinished();
-            return 0;
-        }
-    };
-}
+#include <csignal>
+#include <immintrin.h>
+#include "pipeline.h"
+#include "reactor.h"
+#include "uring.h"
+#include "masking.h"
+#include "affinity.h"
+#include <fstream>
 
 using namespace bparser;
 
@@ -441,7 +47,7 @@ void testIdentifier() {
     const char *ids[]{
             "id", "29835", "lqknlenq", "e34e5r6t7yuijkj"
     };
-    state *startState = buildStateMachine(ids, 4);
+    KeyDfa *startState = buildStateMachine(ids, 4);
     bhft::Message message((char *) R"(
  "lqknlenq"  )");
     input in(message);
@@ -449,121 +55,6 @@ void testIdentifier() {
 
 }
 
-static const char *dataObjectId[] = {"ordId",
-                                     "side",
-                                     "px",
-                                     "sz",
-                                     "state",
-                                     "uTime",
-                                     "instId"};
-static const char *outputObjectId[] = {"\"orderId\"",
-                                       "\"side\"",
-                                       "\"price\"",
-                                       "\"volume\"",
-                                       "\"state\"",
-                                       "\"uTime\""};
-
-static state *dataObjectIdMap = buildStateMachine(dataObjectId, 7);
-
-struct DataObjectCallback : ObjectCallback {
-    bhft::WebSocket *ws;
-    InputDataSet &inputDataSet;
-    InputData *currentInput;
-
-    explicit DataObjectCallback(bhft::WebSocket *ws, InputDataSet &inputDataSet) : ws(ws), inputDataSet(inputDataSet),
-                                                                                   ObjectCallback(dataObjectIdMap),
-                                                                                   currentInput(inputDataSet.end) {
-        currentInput->reset();
-    }
-
-    uint64_t ctol(const char *str_begin, const char *str_end) {
-        uint64_t ans = 0;
-        ++str_begin;
-        --str_end;
-        while (str_begin != str_end) {
-            ans *= 10;
-            ans += (*str_begin++) - '0';
-        }
-        return ans;
-    }
-
-    void valueForField(int fieldId, const char *begin, const char *end) override {
-        if (fieldId < 0) return;
-        if (fieldId == 0) {
-            ++begin;
-            --end;
-        }
-        currentInput->begin[fieldId] = begin;
-        currentInput->end[fieldId] = end;
-        currentInput->mask |= 1 << fieldId;
-    }
-
-    ObjectCallback *willParseObject(int field_id) override {
-        return nullptr;
-    }
-
-    ArrayCallback *willParseArray(int field_id) override {
-        return nullptr;
-    }
-
-    void objectFinished() override {
-        if (currentInput->mask != 0) { // TODO check all required fields
-            currentInput = ++inputDataSet.end;
-        }
-        currentInput->reset();
-    }
-};
-
-
-struct DataArrayCallback : ArrayCallback {
-    DataObjectCallback dataObjectCallback;
-
-    explicit DataArrayCallback(bhft::WebSocket *ws, InputDataSet &inputDataSet) : dataObjectCallback(ws,
-                                                                                                     inputDataSet) {}
-
-    ArrayCallback *willParseArray() override {
-        return nullptr;
-    }
-
-    ObjectCallback *willParseObject() override {
-        return &dataObjectCallback;
-    }
-
-    void nextValue(const char *begin, const char *end) override {
-
-    }
-
-    void arrayFinished() override {
-
-    }
-};
-
-static const char *quoteObjectId[] = {"data"};
-static state *quoteObjectIdMap = buildStateMachine(quoteObjectId, 1);
-
-struct QuoteObjectCallback : ObjectCallback {
-    DataArrayCallback dataArrayCallback;
-
-    explicit QuoteObjectCallback(bhft::WebSocket *ws, InputDataSet &inputDataSet) : dataArrayCallback(ws, inputDataSet),
-                                                                                    ObjectCallback(quoteObjectIdMap) {}
-
-    void valueForField(int field_id, const char *begin, const char *end) override {
-    }
-
-    ObjectCallback *willParseObject(int fieldId) override {
-        return nullptr;
-    }
-
-    ArrayCallback *willParseArray(int field_id) override {
-        return field_id == 0 ? &dataArrayCallback : nullptr;
-    }
-
-    void objectFinished() override {
-
-    }
-};
-
-
 static char buffer[10000000];
 
 uint64_t getDelay(bhft::WebSocket &ws) {
@@ -571,7 +62,7 @@ uint64_t getDelay(bhft::WebSocket &ws) {
     uint64_t delay = 0;
     for (int i = 0; i < iterations; ++i) {
         auto pingMessage = ws.getOutputMessage();
-        bhft::Message pongMessage(buffer);
+        bhft::Message pongMessage(buffer, sizeof(buffer));
         pingMessage.write("ewe");
         TimeMeasurer measurer;
         ws.sendLastOutputMessage(bhft::wsheader_type::PING);
@@ -582,109 +73,6 @@ uint64_t getDelay(bhft::WebSocket &ws) {
     return delay;
 }
 
-std::string getTimeAsString() {
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
-    std::stringstream str;
-    str << std::put_time(&tm, "%d-%m-%Y %H:%M:%S");
-    return str.str();
-}
-
-struct HFTSocket {
-
-    bhft::WebSocket ws;
-    char buffer[4096];
-    int id;
-
-    explicit HFTSocket(int id, bool waitOnSocket) : ws("127.0.0.1", 9999, "?url=wss://ws.okx.com:8443/ws/v5/private",
-                                                       true, waitOnSocket), id(id) {}
-
-    bhft::status login() {
-        bhft::OutputMessage &message = ws.getOutputMessage();
-        const auto p1 = std::chrono::system_clock::now();
-        int timestamp = std::chrono::duration_cast<std::chrono::seconds>(
-                p1.time_since_epoch()).count();
-
-        sprintf(buffer,
-                R"({"op":"login","args":[{"apiKey":"xNEkpMtgh6lF7v8K","passphrase":"","timestamp":%i,"sign":"SkAjqP4LC9UexmrX"}]})",
-                timestamp);
-        message.write(buffer);
-        if (ws.sendLastOutputMessage(bhft::wsheader_type::TEXT_FRAME) == bhft::closed) {
-            return bhft::closed;
-        }
-        bhft::Message inMessage1(buffer);
-        if (ws.getMessage(inMessage1) == bhft::closed) {
-            return bhft::closed;
-        }
-        auto start = std::chrono::system_clock::now();
-        std::cout << id << "\tLogin:\t" << getTimeAsString() << "\t" << buffer << std::endl;
-        return bhft::success;
-    }
-
-    bhft::status subscribe(std::string &subscribeMessage) {
-        bhft::OutputMessage &message2 = ws.getOutputMessage();
-        message2.write(subscribeMessage.c_str());
-        if (ws.sendLastOutputMessage(bhft::wsheader_type::TEXT_FRAME) == bhft::closed) {
-            return bhft::closed;
-        }
-        bhft::Message inMessage2(buffer);
-        if (ws.getMessage(inMessage2) == bhft::closed) {
-            return bhft::closed;
-        }
-        std::cout << id << "\tSubscribe:\t" << getTimeAsString() << "\t" << buffer << std::endl;
-        return bhft::success;
-    }
-
-    bhft::status readMessage(InputDataSet &inputDataSet, bool returnOnNoData = false) {
-        while (true) {
-            bhft::Message inMessage(buffer + 1);
-            auto stat = ws.getMessage(inMessage, returnOnNoData);
-            if (stat != bhft::success) return stat;
-
-            if (logEnabled) {
-                struct timeval now;
-                uint64_t timestamp;
-                gettimeofday(&now, NULL);
-                timestamp = (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_usec;
-                std::stringstream str;
-                str << id << "\t" << timestamp << "\tArrived: " << buffer + 1 << std::endl;
-                std::cout << str.str();
-            }
-            if (inMessage.begin == inMessage.end) continue;
-            if (*inMessage.begin != '{') *--inMessage.begin = '{';
-            if (inMessage.end[-1] != '}') *inMessage.end++ = '}';
-            QuoteObjectCallback quoteObjectCallback(&ws, inputDataSet);
-            input in(inMessage);
-            if (in.parseObject(&quoteObjectCallback) == -2) continue;
-            return bhft::success;
-        }
-    }
-
-    bhft::status writeMessage(const InputData &input) {
-        auto &out = ws.getOutputMessage();
-        char prefix = '{';
-        for (int i = 0; i < 6; ++i) {
-            if ((input.mask >> i) & 1) {
-                out.write(prefix);
-                prefix = ',';
-                out.write(outputObjectId[i]);
-                out.write(':');
-                out.write(input.begin[i], input.end[i]);
-            }
-        }
-        out.write(R"(,"apiKey":"xNEkpMtgh6lF7v8K","sign":"SkAjqP4LC9UexmrX"})");
-        if (ws.sendLastOutputMessage(bhft::wsheader_type::TEXT_FRAME) == bhft::closed) {
-            return bhft::closed;
-        }
-        if (logEnabled) {
-            std::stringstream str;
-            str << id << "\tSending message:\t" << std::string(input.begin[0], input.end[0]) << std::endl;
-            std::cout << str.str();
-        }
-        return bhft::success;
-    }
-};
-
 struct ReportOnExit {
     const char *message;
     int id;
@@ -692,7 +80,7 @@ struct ReportOnExit {
     explicit ReportOnExit(const char *message, int id) : message(message), id(id) {}
 
     virtual ~ReportOnExit() {
-        std::cout << id << "\t" << message;
+        bhft::logger.log(bhft::logText, id, 0, message);
     }
 
     void setMessage(const char *newMessage) {
@@ -700,13 +88,25 @@ struct ReportOnExit {
     }
 };
 
-void process(int threadId, int id, std::string &subscribeMessage, bool waitOnSocket, int maxFine, int skipFine) {
+void process(int threadId, int id, std::string &subscribeMessage, const bhft::SocketOptions &socketOptions,
+             int maxFine, int skipFine) {
     ReportOnExit reporter("Closed by server\n", id);
-    HFTSocket hftSocket(id, waitOnSocket);
+    HFTSocket hftSocket(id, socketOptions, threadSync.pipeline[threadId], threadSync.journalFor(threadId));
+    struct WaitStatsOnExit {
+        HFTSocket &hftSocket;
+        int threadId;
+
+        ~WaitStatsOnExit() {
+            reportWaitStats(hftSocket.id, hftSocket.ws.socket.waitStats);
+            reportSendStats(hftSocket.id, hftSocket.ws.socket.sendStats);
+            // the histograms belong to the slot and span its reconnects
+            reportPipelineStats(threadId, hftSocket.stats);
+        }
+    } waitStatsOnExit{hftSocket, threadId};
     threadSync.socket[threadId] = hftSocket.ws.socket.socket;
     if (hftSocket.login() == bhft::closed) return;
     if (hftSocket.subscribe(subscribeMessage) == bhft::closed) return;
-    InputData inputData[10];
+    InputData inputData[InputDataSet::capacity];
     int fine = 0;
     int iter = 0;
     if (skipFine > 0) {
@@ -717,39 +117,269 @@ void process(int threadId, int id, std::string &subscribeMessage, bool waitOnSoc
         if (fine > maxFine) {
             return;
         }
-        InputDataSet inputDataSet(inputData, inputData);
+        InputDataSet inputDataSet(inputData, inputData, inputData + InputDataSet::capacity);
         TimeMeasurer timeMeasurer;
-        auto stat = hftSocket.readMessage(inputDataSet, true);
+        auto stat = hftSocket.readMessage(inputDataSet);
         if (logEnabled) {
-            auto ellapsed = timeMeasurer.elapsedMicroSec();
-            if (ellapsed > 10000000) std::cout << "BIGBIGBIGBIGBIGBIG" << std::endl;
-            else if (ellapsed > 10000) std::cout << "BIG" << std::endl;
-            std::cout << "Read message ellapsed microsec:\t" << ellapsed << std::endl;
+            bhft::logger.log(bhft::logReadElapsed, id, timeMeasurer.elapsedMicroSec());
         }
         if (stat == bhft::closed) return;
-        for (auto input = inputDataSet.begin; input != inputDataSet.end; ++input) {
-            uint64_t inputId = input->getId();
-            Mutex mutex(threadSync.locker);
-            int cnt = threadSync.getCount(inputId);
-            if (cnt > 0) {
-                if (iter > skipFine) {
-                    fine += (1 << (cnt - 1)) - 1;
+        if (forwardInputs(hftSocket, inputDataSet, fine, iter, skipFine) == bhft::closed) return;
+    }
+}
+
+// One connection owned by the reactor thread. Mirrors process(): when the
+// server closes the socket it is reopened after the same randomized delay.
+// Opening blocks (connect, HTTP upgrade, login, subscribe), so it runs on the
+// reactor's connector thread and the reactor adopts the finished socket.
+struct Session : bhft::Reactor::Handler {
+    bhft::Reactor &reactor;
+    int threadId;
+    int counter;
+    std::string &subscribeMessage;
+    const bhft::SocketOptions &socketOptions;
+    int maxFine;
+    int skipFine;
+    int skipFineLimit = 0;
+    std::unique_ptr<HFTSocket> hftSocket;
+    InputData inputData[InputDataSet::capacity];
+    int fine = 0;
+    int iter = 0;
+    TimeMeasurer closedAt;
+    uint64_t reconnectDelayMilliSec = 0;
+    bool watchingWrites = false;
+    // set by the reactor, then the connector fills connected and sets connectDone
+    std::atomic<bool> connectRequested{false};
+    std::atomic<bool> connectDone{false};
+    std::unique_ptr<HFTSocket> connected;
+
+    Session(bhft::Reactor &reactor, int threadId, std::string &subscribeMessage,
+            const bhft::SocketOptions &socketOptions, int maxFine, int skipFine)
+            : reactor(reactor), threadId(threadId), counter((threadId + 1) * 10000),
+              subscribeMessage(subscribeMessage), socketOptions(socketOptions), maxFine(maxFine),
+              skipFine(skipFine) {
+        scheduleReconnect();
+    }
+
+    void scheduleReconnect() {
+        closedAt.reset();
+        reconnectDelayMilliSec = 1000 + rand() % 1000;
+    }
+
+    bool readyToReconnect() {
+        return hftSocket == nullptr && !connectRequested.load(std::memory_order_relaxed) &&
+               closedAt.elapsedMilliSec() >= reconnectDelayMilliSec;
+    }
+
+    // Connector thread.
+    void connect() {
+        int id = counter++;
+        // io_uring is attached in adopt(), the ring belongs to the reactor thread
+        bhft::SocketOptions options = socketOptions;
+        if (options.transport == bhft::ioUring) options.transport = bhft::syscalls;
+        // no journal yet, it has a single writer: the reactor thread
+        auto socket = std::make_unique<HFTSocket>(id, options, threadSync.pipeline[threadId], nullptr);
+        if (socket->isClosed() || socket->login() == bhft::closed ||
+            socket->subscribe(subscribeMessage) == bhft::closed) {
+            bhft::logger.log(bhft::logText, id, 0, "Closed by server\n");
+            socket.reset();
+        }
+        connected = std::move(socket);
+        connectDone.store(true, std::memory_order_release);
+    }
+
+    // Reactor thread, once connectDone is set.
+    void adopt() {
+        hftSocket = std::move(connected);
+        connectRequested.store(false);
+        connectDone.store(false);
+        if (hftSocket == nullptr) {
+            scheduleReconnect();
+            return;
+        }
+        auto &socket = hftSocket->ws.socket;
+        if (socketOptions.transport == bhft::ioUring && !socket.enableUring(socketOptions.batchSubmit)) {
+            fprintf(stderr, "io_uring unavailable, falling back to recv/send\n");
+        }
+        hftSocket->journal = threadSync.journalFor(0);
+        threadSync.socket[threadId] = socket.socket;
+        fine = 0;
+        iter = 0;
+        watchingWrites = false;
+        skipFineLimit = skipFine > 0 ? skipFine + rand() % skipFine : 0;
+        if (!addToReactor()) {
+            bhft::logger.log(bhft::logText, hftSocket->id, 0, "Closed by server\n");
+            hftSocket.reset();
+            scheduleReconnect();
+            return;
+        }
+        // login/subscribe may have pulled updates into the socket buffer already
+        if (onReadable() == bhft::closed) onClosed();
+    }
+
+    // connections on a thread's io_uring all wake through the one ring descriptor
+    bool addToReactor() {
+        auto &socket = hftSocket->ws.socket;
+        return socket.uring != nullptr ? reactor.addShared(socket.pollFd(), this) : reactor.add(socket.pollFd(), this);
+    }
+
+    bhft::status onReadable() override {
+        while (true) {
+            if (fine > maxFine) return bhft::closed;
+            InputDataSet inputDataSet(inputData, inputData, inputData + InputDataSet::capacity);
+            auto stat = hftSocket->readMessage(inputDataSet, true);
+            if (stat != bhft::success) return stat == bhft::noData ? bhft::success : stat;
+            ++iter;
+            if (forwardInputs(*hftSocket, inputDataSet, fine, iter, skipFineLimit) == bhft::closed) {
+                return bhft::closed;
+            }
+            watchWrites();
+        }
+    }
+
+    bhft::status onWritable() override {
+        // the socket may have been closed earlier in the same batch
+        if (hftSocket == nullptr) return bhft::success;
+        if (hftSocket->ws.socket.flushOutbound() == bhft::closed) return bhft::closed;
+        watchWrites();
+        return bhft::success;
+    }
+
+    void watchWrites() {
+        auto &socket = hftSocket->ws.socket;
+        bool pending = socket.hasPendingOutput();
+        if (pending != watchingWrites &&
+            reactor.watchWritable(socket.pollFd(), socket.socket, this, pending)) {
+            watchingWrites = pending;
+        }
+    }
+
+    void onClosed() override {
+        if (hftSocket == nullptr) return;
+        if (watchingWrites) {
+            reactor.watchWritable(hftSocket->ws.socket.pollFd(), hftSocket->ws.socket.socket, this, false);
+        }
+        if (hftSocket->ws.socket.uring != nullptr) {
+            reactor.removeShared(hftSocket->ws.socket.pollFd(), this);
+        } else {
+            reactor.remove(hftSocket->ws.socket.pollFd());
+        }
+        reportSendStats(hftSocket->id, hftSocket->ws.socket.sendStats);
+        reportWaitStats(hftSocket->id, hftSocket->ws.socket.waitStats);
+        reportPipelineStats(threadId, hftSocket->stats);
+        bhft::logger.log(bhft::logText, hftSocket->id, 0, "Closed by server\n");
+        hftSocket.reset();
+        scheduleReconnect();
+    }
+};
+
+// Wakes the reactor when the connector has finished opening a session.
+struct ConnectorWakeup : bhft::Reactor::Handler {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    ~ConnectorWakeup() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    void notify() {
+        uint64_t one = 1;
+        if (::write(fd, &one, sizeof(one)) < 0) perror("eventfd write");
+    }
+
+    bhft::status onReadable() override {
+        uint64_t count;
+        if (::read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("eventfd read");
+        return bhft::success;
+    }
+
+    bhft::status onWritable() override {
+        return bhft::success;
+    }
+
+    void onClosed() override {}
+};
+
+void reactorLoop(int connections, std::string &subscribeMessage, const bhft::SocketOptions &socketOptions,
+                 int maxFine, int skipFine, const bhft::ThreadPlacement &placement) {
+    bhft::Reactor reactor;
+    if (socketOptions.wait == bhft::busyPollWait) {
+        bhft::enableEpollBusyPoll(reactor.epollFd, socketOptions.busyPollMicroSec);
+    }
+    std::vector<std::unique_ptr<Session>> sessions;
+    for (int i = 0; i < connections; ++i) {
+        sessions.push_back(std::make_unique<Session>(reactor, i, subscribeMessage, socketOptions,
+                                                     i < 2 ? 1000000 : maxFine, skipFine));
+    }
+    ConnectorWakeup wakeup;
+    if (wakeup.fd < 0 || !reactor.add(wakeup.fd, &wakeup)) {
+        perror("eventfd");
+        return;
+    }
+    std::atomic<bool> connecting{true};
+    std::thread connector([&sessions, &connecting, &wakeup]() {
+        while (connecting.load(std::memory_order_relaxed)) {
+            bool any = false;
+            for (auto &session: sessions) {
+                if (!session->connectRequested.load(std::memory_order_acquire) ||
+                    session->connectDone.load(std::memory_order_relaxed)) {
+                    continue;
                 }
-                continue;
+                session->connect();
+                wakeup.notify();
+                any = true;
             }
-            if (hftSocket.writeMessage(*input) == bhft::closed) {
-                return;
+            if (!any) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    // only now: the connector keeps the affinity and policy the reactor had
+    bhft::placeThread(placement, "reactor");
+    while (true) {
+        for (auto &session: sessions) {
+            if (session->connectDone.load(std::memory_order_acquire)) {
+                session->adopt();
+            } else if (session->readyToReconnect()) {
+                session->connectRequested.store(true, std::memory_order_release);
             }
-            threadSync.add(inputId);
         }
+        if (reactor.poll(100) < 0) {
+            perror("epoll_wait");
+            break;
+        }
+        // one io_uring_enter for the sends of every connection served in this pass
+        bhft::Uring::submitForThread();
     }
+    connecting = false;
+    connector.join();
+}
+
+volatile sig_atomic_t stopRequested = 0;
+
+void requestStop(int) {
+    stopRequested = 1;
 }
 
-void processLoop(int id, std::string &subscribeMessage, bool waitOnSocket, int maxFine, int skipFine) {
+void reportStats(int connections) {
+    if (lockFreeDedup) {
+        reportDedupStats(threadSync.orders.stats);
+    } else {
+        reportLockStats("Dedup", threadSync.locker.stats);
+    }
+    for (int i = 0; i < connections; ++i) {
+        reportPipelineStats(i, threadSync.pipeline[i]);
+        bhft::Journal *journal = threadSync.journalFor(i);
+        if (journal != nullptr) {
+            std::cout << i << "\tJournal:\trecords=" << journal->records << "\tdropped=" << journal->dropped
+                      << "\tsegments=" << journal->nextSegment << std::endl;
+        }
+    }
+}
+
+void processLoop(int id, std::string &subscribeMessage, const bhft::SocketOptions &socketOptions, int maxFine,
+                 int skipFine) {
     int counter = (id + 1) * 10000;
     while (true) {
         std::this_thread::sleep_for(std::chrono::milliseconds(1000 + rand() % 1000));
-        process(id, counter++, subscribeMessage, waitOnSocket, maxFine, skipFine);
+        process(id, counter++, subscribeMessage, socketOptions, maxFine, skipFine);
     }
 }
 
@@ -763,10 +393,36 @@ int main(int argc, char **argv) {
         if (!(index = arg.find('='))) return -1;
         map[arg.substr(0, index)] = arg.substr(index + 1);
     }
+    // config=file holds the same key=value pairs one per line, the command line wins
+    if (map.find("config") != map.end()) {
+        std::ifstream config(map["config"]);
+        if (!config) {
+            std::cout << "Cannot read config " << map["config"] << std::endl;
+            return -1;
+        }
+        std::string line;
+        while (std::getline(config, line)) {
+            size_t index = line.find('=');
+            if (line.empty() || line[0] == '#' || index == std::string::npos) continue;
+            map.insert({line.substr(0, index), line.substr(index + 1)});
+        }
+    }
 
 
     uint64_t bestDelay = 10000000;
     if (map["log"] == "true") logEnabled = true;
+    if (map["tsc"] == "false") bhft::tscClock.disableTsc();
+    std::cout << "Clock: " << (bhft::tscClock.useTsc ? "tsc " : "monotonic ")
+              << (bhft::tscClock.invariantTsc ? "invariant " : "not invariant ") << std::fixed
+              << std::setprecision(3) << bhft::tscClock.ticksPerNanoSec << " ticks/ns" << std::endl;
+    if (map["mask"] == "false") maskEnabled = false;
+    if (map["dedup"] == "spinlock") lockFreeDedup = false;
+    if (map["keys"] == "dfa") compiledKeys = false;
+    if (map["scan"] == "bytes") structuralScan = false;
+    if (map["callbacks"] == "virtual") staticCallbacks = false;
+    // size for the order rate times the window, the table degrades into premature evictions when full
+    threadSync.orders.init(map.find("dedupSize") != map.end() ? stoul(map["dedupSize"]) : 1 << 18,
+                           map.find("dedupWindow") != map.end() ? stoul(map["dedupWindow"]) : 5000);
     std::string channel = (map.find("channel") != map.end()) ? map["channel"] : "orders";
     std::string instType = (map.find("instType") != map.end()) ? map["instType"] : "ANY";
     std::string instId = (map.find("instId") != map.end()) ? map["instId"] : "";
@@ -774,8 +430,34 @@ int main(int argc, char **argv) {
     std::string instIdStr = (instId.empty()) ? "" : R"(,"instId":")" + instId + R"(")";
     int loginUpperBound = (map.find("loginLimit") == map.end()) ? 20000 : stoi(map["loginLimit"]);
     int logLevel = (map.find("logLevel") == map.end()) ? 1 : stoi(map["logLevel"]);
+    if (logLevel < 1 || logLevel > ThreadSync::maxThreads) {
+        std::cout << "logLevel must be between 1 and " << ThreadSync::maxThreads << std::endl;
+        return -1;
+    }
     int skipFine = (map.find("skip") == map.end()) ? 0 : stoi(map["skip"]);
-    bool waitOnSocket = map["wait"] == "true";
+    bhft::SocketOptions socketOptions;
+    socketOptions.wait = map["wait"] == "true" ? bhft::selectWait : bhft::sleepWait;
+    std::map<std::string, bhft::waitPolicy> waitPolicies{{"sleep",         bhft::sleepWait},
+                                                         {"select",        bhft::selectWait},
+                                                         {"spin",          bhft::spinWait},
+                                                         {"spinThenBlock", bhft::spinThenBlock},
+                                                         {"busyPoll",      bhft::busyPollWait}};
+    if (waitPolicies.find(map["waitPolicy"]) != waitPolicies.end()) socketOptions.wait = waitPolicies[map["waitPolicy"]];
+    if (map.find("spinLimit") != map.end()) socketOptions.spinLimit = stoi(map["spinLimit"]);
+    if (map.find("busyPoll") != map.end()) socketOptions.busyPollMicroSec = stoi(map["busyPoll"]);
+    if (map.find("ringSize") != map.end()) socketOptions.ringSize = stoul(map["ringSize"]);
+    socketOptions.timestamping = map["timestamping"] == "true";
+    if (map.find("outboundSize") != map.end()) socketOptions.outboundSize = stoul(map["outboundSize"]);
+    if (map.find("maskKernel") != map.end() && !bhft::selectMaskKernel(map["maskKernel"].c_str())) {
+        std::cout << "Unsupported mask kernel " << map["maskKernel"] << ", using " << bhft::maskCopyName() << std::endl;
+    }
+    if (map.find("scanKernel") != map.end() && !bparser::selectScanKernel(map["scanKernel"].c_str())) {
+        std::cout << "Unsupported scan kernel " << map["scanKernel"] << ", using " << bparser::scanKernelName()
+                  << std::endl;
+    }
+    socketOptions.transport = map["transport"] == "uring" ? bhft::ioUring : bhft::syscalls;
+    bool useReactor = map["reactor"] == "true";
+    socketOptions.batchSubmit = useReactor;
     int fine = (map.find("fine") == map.end()) ? 500 : stoi(map["fine"]);
 
     std::string subscribeMessage =
@@ -784,21 +466,78 @@ int main(int argc, char **argv) {
             R"(}]})";
     std::cout << "Subscribe message: \t" << subscribeMessage << std::endl;
 
+    // cpus=2-5 or cpus=isolated pins connection threads round robin, mainCpu= the killer thread;
+    // fifo= gives connection threads SCHED_FIFO, numaLocal=true keeps their memory on the pinned node
+    std::vector<int> cpus = map["cpus"] == "isolated" ? bhft::isolatedCpus() : bhft::parseCpuList(map["cpus"]);
+    if (map["cpus"] == "isolated" && cpus.empty()) std::cout << "No isolated cpus, threads are not pinned\n";
+    bhft::ThreadPlacement workerPlacement;
+    workerPlacement.fifoPriority = map.find("fifo") == map.end() ? -1 : stoi(map["fifo"]);
+    workerPlacement.localMemory = map["numaLocal"] == "true";
+    auto placementFor = [&cpus, workerPlacement](int i) {
+        bhft::ThreadPlacement placement = workerPlacement;
+        if (!cpus.empty()) placement.cpu = cpus[i % cpus.size()];
+        return placement;
+    };
+    if (map.find("journal") != map.end()) {
+        // one journal per connection thread, so appends need no synchronization
+        size_t segmentSize = (map.find("journalSegmentMb") == map.end() ? 64 : stoul(map["journalSegmentMb"])) << 20;
+        int journals = useReactor ? 1 : logLevel;
+        for (int i = 0; i < journals; ++i) {
+            if (!threadSync.journal[i].open(map["journal"], i, segmentSize)) return -1;
+            threadSync.journalRoller.add(&threadSync.journal[i]);
+        }
+        threadSync.journalRoller.start();
+    }
+
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+    bhft::logger.start();
     std::vector<std::thread> threads;
-    for (int i = 0; i < logLevel; ++i) {
-        threads.push_back(std::thread([&subscribeMessage, i, waitOnSocket, fine, skipFine]() {
-            processLoop(i, subscribeMessage, waitOnSocket, i < 2 ? 1000000 : fine, skipFine);
+    if (useReactor) {
+        bhft::ThreadPlacement placement = placementFor(0);
+        threads.push_back(std::thread([&subscribeMessage, &socketOptions, logLevel, fine, skipFine, placement]() {
+            reactorLoop(logLevel, subscribeMessage, socketOptions, fine, skipFine, placement);
+        }));
+    }
+    for (int i = 0; i < logLevel && !useReactor && !stopRequested; ++i) {
+        bhft::ThreadPlacement placement = placementFor(i);
+        threads.push_back(std::thread([&subscribeMessage, &socketOptions, i, fine, skipFine, placement]() {
+            // before the first connection so its buffers are first touched on the right cpu/node
+            bhft::placeThread(placement, "process");
+            processLoop(i, subscribeMessage, socketOptions, i < 2 ? 1000000 : fine, skipFine);
         }));
         sleep((rand() % 1000) / 100.0);
     }
+    if (map.find("mainCpu") != map.end()) {
+        // only now: threads inherit their creator's affinity, and the logger,
+        // journal roller and unpinned connection threads must not share this cpu
+        bhft::ThreadPlacement mainPlacement;
+        mainPlacement.cpu = stoi(map["mainCpu"]);
+        bhft::placeThread(mainPlacement, "main");
+    }
+    uint64_t statsIntervalMilliSec = map.find("statsInterval") == map.end() ? 10000 : stoul(map["statsInterval"]) * 1000;
+    TimeMeasurer statsTimer;
+    TimeMeasurer killTimer;
+    uint64_t killDelayMilliSec = 20000 + rand() % 10000;
     int i = 0;
-    while (true) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(20000 + rand() % 10000));
+    while (!stopRequested) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if (statsTimer.elapsedMilliSec() >= statsIntervalMilliSec) {
+            reportStats(logLevel);
+            statsTimer.reset();
+        }
+        if (killTimer.elapsedMilliSec() < killDelayMilliSec) continue;
         bhft::socket_t socket = threadSync.socket[(i++) % 2];
-        closesocket(socket);
-    }
-    for (int i = 0; i < logLevel; ++i) {
-        threads[i].join();
-    }
-
+        // shutdown rather than close: the owner still gets EOF (and an epoll
+        // wakeup in reactor mode) and closes the descriptor itself
+        ::shutdown(socket, SHUT_RDWR);
+        killTimer.reset();
+        killDelayMilliSec = 20000 + rand() % 10000;
+    }
+    reportStats(logLevel);
+    threadSync.journalRoller.stop();
+    bhft::logger.stop();
+    std::cout.flush();
+    // connection threads never return, leave without unwinding under them
+    _exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "masking.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+namespace bhft {
+
+    // The key as it applies to a chunk that starts at byte index.
+    static inline uint32_t rotatedKey(const uint8_t *mask, size_t index) {
+        uint32_t key;
+        memcpy(&key, mask, sizeof(key));
+        unsigned shift = (index & 3) * 8;
+        return shift == 0 ? key : (key >> shift) | (key << (32 - shift));
+    }
+
+    static inline void maskTail(char *dst, const char *src, size_t count, uint32_t key) {
+        uint64_t key64 = key | ((uint64_t) key << 32);
+        for (; count >= 8; count -= 8, dst += 8, src += 8) {
+            uint64_t chunk;
+            memcpy(&chunk, src, 8);
+            chunk ^= key64;
+            memcpy(dst, &chunk, 8);
+        }
+        const auto *keyBytes = reinterpret_cast<const uint8_t *>(&key);
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = (char) (src[i] ^ keyBytes[i & 3]);
+        }
+    }
+
+    static void maskScalar(char *dst, const char *src, size_t count, const uint8_t *mask, size_t index) {
+        maskTail(dst, src, count, rotatedKey(mask, index));
+    }
+
+    __attribute__((target("sse2")))
+    static void maskSse2(char *dst, const char *src, size_t count, const uint8_t *mask, size_t index) {
+        uint32_t key = rotatedKey(mask, index);
+        __m128i k = _mm_set1_epi32((int) key);
+        for (; count >= 16; count -= 16, dst += 16, src += 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_xor_si128(chunk, k));
+        }
+        maskTail(dst, src, count, key);
+    }
+
+    __attribute__((target("avx2")))
+    static void maskAvx2(char *dst, const char *src, size_t count, const uint8_t *mask, size_t index) {
+        uint32_t key = rotatedKey(mask, index);
+        __m256i k = _mm256_set1_epi32((int) key);
+        for (; count >= 64; count -= 64, dst += 64, src += 64) {
+            __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+            __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_xor_si256(first, k));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 32), _mm256_xor_si256(second, k));
+        }
+        if (count >= 32) {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_xor_si256(chunk, k));
+            count -= 32;
+            dst += 32;
+            src += 32;
+        }
+        if (count >= 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_xor_si128(chunk, _mm256_castsi256_si128(k)));
+            count -= 16;
+            dst += 16;
+            src += 16;
+        }
+        maskTail(dst, src, count, key);
+    }
+
+    __attribute__((target("avx512f,avx512bw,bmi2")))
+    static void maskAvx512(char *dst, const char *src, size_t count, const uint8_t *mask, size_t index) {
+        uint32_t key = rotatedKey(mask, index);
+        __m512i k = _mm512_set1_epi32((int) key);
+        for (; count >= 64; count -= 64, dst += 64, src += 64) {
+            __m512i chunk = _mm512_loadu_si512(src);
+            _mm512_storeu_si512(dst, _mm512_xor_si512(chunk, k));
+        }
+        if (count > 0) {
+            // masked load/store never touches bytes past the end
+            __mmask64 tail = _bzhi_u64(~0ull, (unsigned) count);
+            __m512i chunk = _mm512_maskz_loadu_epi8(tail, src);
+            _mm512_mask_storeu_epi8(dst, tail, _mm512_xor_si512(chunk, k));
+        }
+    }
+
+    static bool always() {
+        return true;
+    }
+
+    static bool hasSse2() {
+        return __builtin_cpu_supports("sse2");
+    }
+
+    static bool hasAvx2() {
+        return __builtin_cpu_supports("avx2");
+    }
+
+    static bool hasAvx512() {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+               __builtin_cpu_supports("bmi2");
+    }
+
+    const MaskKernel maskKernels[] = {
+            {"scalar", maskScalar, always},
+            {"sse2",   maskSse2,   hasSse2},
+            {"avx2",   maskAvx2,   hasAvx2},
+            {"avx512", maskAvx512, hasAvx512},
+    };
+    const int maskKernelCount = sizeof(maskKernels) / sizeof(maskKernels[0]);
+
+    static const MaskKernel *selected = nullptr;
+
+    static maskFunction selectBest() {
+        __builtin_cpu_init();
+        for (int i = maskKernelCount - 1; i >= 0; --i) {
+            if (maskKernels[i].supported()) {
+                selected = &maskKernels[i];
+                return selected->function;
+            }
+        }
+        return maskScalar;
+    }
+
+    maskFunction maskCopy = selectBest();
+
+    const char *maskCopyName() {
+        return selected->name;
+    }
+
+    bool selectMaskKernel(const char *name) {
+        for (int i = 0; i < maskKernelCount; ++i) {
+            if (strcmp(maskKernels[i].name, name) == 0 && maskKernels[i].supported()) {
+                selected = &maskKernels[i];
+                maskCopy = selected->function;
+                return true;
+            }
+        }
+        return false;
+    }
+
+} // bhft
@@ -0,0 +1,33 @@
+#ifndef HFT_FRAMEWORK_USERDATA_MASKING_H
+#define HFT_FRAMEWORK_USERDATA_MASKING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bhft {
+
+    // dst[i] = src[i] ^ mask[(index + i) & 3] for exactly count bytes, dst may
+    // be src. Used both to unmask received frames and to mask outgoing ones.
+    typedef void (*maskFunction)(char *dst, const char *src, size_t count, const uint8_t *mask, size_t index);
+
+    struct MaskKernel {
+        const char *name;
+        maskFunction function;
+
+        bool (*supported)();
+    };
+
+    extern const MaskKernel maskKernels[];
+    extern const int maskKernelCount;
+
+    // Widest kernel the CPU supports, picked once at startup.
+    extern maskFunction maskCopy;
+
+    const char *maskCopyName();
+
+    // Overrides the startup choice, returns false for unknown or unsupported kernels.
+    bool selectMaskKernel(const char *name);
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_MASKING_H
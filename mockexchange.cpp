@@ -0,0 +1,353 @@
+// Stands in for the proxy on 127.0.0.1:9999: accepts the WebSocket upgrade,
+// answers login and subscribe, pushes synthetic orders channel updates and
+// timestamps the responses, for end-to-end runs on one box:
+//   mockexchange [port=9999] [rate=1000] [count=10000] [burst=1] [jitter=false]
+//                [updates=2] [fanout=all|split] [connections=1] [linger=1000]
+// rate is orders per second on average, sent burst orders at a time; jitter
+// spaces bursts exponentially instead of evenly. Every order is pushed as
+// `updates` frames (live, then filled) to every subscribed connection, or to
+// one of them in turn with fanout=split. Pushing starts once `connections`
+// have subscribed and the report comes linger ms after the last order.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+#include "histogram.h"
+#include "tscclock.h"
+
+struct Connection {
+    int fd;
+    // 0 waiting for the upgrade, 1 for login, 2 for subscribe, 3 live
+    int stage = 0;
+    std::atomic<bool> live{false};
+    std::atomic<bool> closed{false};
+    std::string input;
+    std::mutex writeLock;
+
+    explicit Connection(int fd) : fd(fd) {}
+
+    void send(const std::string &data) {
+        std::lock_guard<std::mutex> guard(writeLock);
+        size_t sent = 0;
+        while (sent < data.size() && !closed) {
+            ssize_t ret = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (ret <= 0) {
+                closed = true;
+                return;
+            }
+            sent += ret;
+        }
+    }
+};
+
+struct MockExchange {
+    static const uint64_t firstOrderId = 1000;
+
+    int count;
+    std::vector<std::atomic<uint64_t>> sendNanoSec;
+    // reader thread only
+    std::vector<uint32_t> acks;
+    bhft::Histogram roundTrip;
+    uint64_t responses = 0;
+    uint64_t unknownResponses = 0;
+    uint64_t firstAckNanoSec = 0;
+    uint64_t lastAckNanoSec = 0;
+
+    std::mutex connectionsLock;
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::atomic<int> liveCount{0};
+
+    explicit MockExchange(int count) : count(count), sendNanoSec(count), acks(count) {}
+
+    static std::string frame(int opcode, const char *data, size_t size) {
+        std::string out;
+        out += (char) (0x80 | opcode);
+        if (size < 126) {
+            out += (char) size;
+        } else if (size < 65536) {
+            out += (char) 126;
+            out += (char) (size >> 8);
+            out += (char) size;
+        } else {
+            out += (char) 127;
+            for (int i = 7; i >= 0; --i) out += (char) (size >> (i * 8));
+        }
+        out.append(data, size);
+        return out;
+    }
+
+    static std::string textFrame(const std::string &text) {
+        return frame(1, text.data(), text.size());
+    }
+
+    std::vector<std::shared_ptr<Connection>> liveConnections() {
+        std::lock_guard<std::mutex> guard(connectionsLock);
+        std::vector<std::shared_ptr<Connection>> result;
+        for (auto &connection: connections) {
+            if (connection->live && !connection->closed) result.push_back(connection);
+        }
+        return result;
+    }
+
+    void onResponse(const char *data, size_t size) {
+        uint64_t now = bhft::monotonicNanoSec();
+        ++responses;
+        std::string text(data, size);
+        size_t position = text.find("\"orderId\"");
+        if (position == std::string::npos) {
+            ++unknownResponses;
+            return;
+        }
+        position += 9;
+        while (position < text.size() && (text[position] < '0' || text[position] > '9')) ++position;
+        uint64_t orderId = 0;
+        while (position < text.size() && text[position] >= '0' && text[position] <= '9') {
+            orderId = orderId * 10 + (text[position++] - '0');
+        }
+        uint64_t index = orderId - firstOrderId;
+        if (orderId < firstOrderId || index >= (uint64_t) count) {
+            ++unknownResponses;
+            return;
+        }
+        if (acks[index]++ == 0) {
+            uint64_t sent = sendNanoSec[index].load(std::memory_order_acquire);
+            if (sent != 0 && now > sent) roundTrip.record(now - sent);
+            if (firstAckNanoSec == 0) firstAckNanoSec = now;
+            lastAckNanoSec = now;
+        }
+    }
+
+    // Upgrade request, then masked client frames.
+    void onReadable(Connection &connection) {
+        char buffer[65536];
+        ssize_t ret = ::recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (ret <= 0) {
+            connection.closed = true;
+            if (connection.live.exchange(false)) --liveCount;
+            return;
+        }
+        connection.input.append(buffer, ret);
+        if (connection.stage == 0) {
+            size_t end = connection.input.find("\r\n\r\n");
+            if (end == std::string::npos) return;
+            connection.input.erase(0, end + 4);
+            // the client always sends the RFC 6455 sample key and doesn't check the answer
+            connection.send("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                            "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n\r\n");
+            connection.stage = 1;
+        }
+        size_t offset = 0;
+        std::string &in = connection.input;
+        while (in.size() - offset >= 2) {
+            auto *header = reinterpret_cast<const uint8_t *>(in.data() + offset);
+            int opcode = header[0] & 0x0f;
+            bool masked = header[1] & 0x80;
+            uint64_t size = header[1] & 0x7f;
+            size_t headerSize = 2;
+            if (size == 126) {
+                if (in.size() - offset < 4) break;
+                size = (header[2] << 8) | header[3];
+                headerSize = 4;
+            } else if (size == 127) {
+                if (in.size() - offset < 10) break;
+                size = 0;
+                for (int i = 0; i < 8; ++i) size = (size << 8) | header[2 + i];
+                headerSize = 10;
+            }
+            size_t maskOffset = headerSize;
+            if (masked) headerSize += 4;
+            if (in.size() - offset < headerSize + size) break;
+            char *payload = &in[offset + headerSize];
+            if (masked) {
+                const uint8_t *mask = header + maskOffset;
+                for (uint64_t i = 0; i < size; ++i) payload[i] ^= (char) mask[i & 3];
+            }
+            offset += headerSize + size;
+            if (opcode == 9) {
+                connection.send(frame(10, payload, size));
+            } else if (opcode == 8) {
+                connection.closed = true;
+                if (connection.live.exchange(false)) --liveCount;
+                return;
+            } else if (connection.stage == 1) {
+                connection.send(textFrame(R"({"event":"login","code":"0"})"));
+                connection.stage = 2;
+            } else if (connection.stage == 2) {
+                connection.send(textFrame(R"({"event":"subscribe","arg":{"channel":"orders"}})"));
+                connection.stage = 3;
+                connection.live = true;
+                ++liveCount;
+            } else {
+                onResponse(payload, size);
+            }
+        }
+        in.erase(0, offset);
+    }
+
+    void serve(int listener) {
+        int epollFd = ::epoll_create1(0);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        ::epoll_ctl(epollFd, EPOLL_CTL_ADD, listener, &event);
+        epoll_event events[64];
+        while (true) {
+            int ready = ::epoll_wait(epollFd, events, 64, -1);
+            for (int i = 0; i < ready; ++i) {
+                auto *connection = static_cast<Connection *>(events[i].data.ptr);
+                if (connection == nullptr) {
+                    int fd = ::accept(listener, nullptr, nullptr);
+                    if (fd < 0) continue;
+                    int flag = 1;
+                    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+                    auto added = std::make_shared<Connection>(fd);
+                    {
+                        std::lock_guard<std::mutex> guard(connectionsLock);
+                        connections.push_back(added);
+                    }
+                    epoll_event connectionEvent{};
+                    connectionEvent.events = EPOLLIN;
+                    connectionEvent.data.ptr = added.get();
+                    ::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &connectionEvent);
+                    continue;
+                }
+                onReadable(*connection);
+                if (connection->closed) {
+                    ::epoll_ctl(epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+                    {
+                        // send() checks closed under the same lock, so the fd is not reused under it
+                        std::lock_guard<std::mutex> guard(connection->writeLock);
+                        ::close(connection->fd);
+                    }
+                    // the pusher may still hold a reference from liveConnections()
+                    std::lock_guard<std::mutex> guard(connectionsLock);
+                    connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                                     [connection](const std::shared_ptr<Connection> &entry) {
+                                                         return entry.get() == connection;
+                                                     }), connections.end());
+                }
+            }
+        }
+    }
+};
+
+int main(int argc, char **argv) {
+    std::map<std::string, std::string> map;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t index = arg.find('=');
+        if (index == std::string::npos) return -1;
+        map[arg.substr(0, index)] = arg.substr(index + 1);
+    }
+    int port = map.find("port") == map.end() ? 9999 : stoi(map["port"]);
+    double rate = map.find("rate") == map.end() ? 1000 : stod(map["rate"]);
+    int count = map.find("count") == map.end() ? 10000 : stoi(map["count"]);
+    int burst = map.find("burst") == map.end() ? 1 : std::max(1, stoi(map["burst"]));
+    int updates = map.find("updates") == map.end() ? 2 : std::max(1, stoi(map["updates"]));
+    int expectedConnections = map.find("connections") == map.end() ? 1 : stoi(map["connections"]);
+    uint64_t lingerMilliSec = map.find("linger") == map.end() ? 1000 : stoul(map["linger"]);
+    bool jitter = map["jitter"] == "true";
+    bool split = map["fanout"] == "split";
+
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    int flag = 1;
+    ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(listener, (sockaddr *) &address, sizeof(address)) != 0 || ::listen(listener, 64) != 0) {
+        perror("bind");
+        return -1;
+    }
+    MockExchange exchange(count);
+    std::thread([&exchange, listener] { exchange.serve(listener); }).detach();
+    std::cout << "Listening on 127.0.0.1:" << port << ", waiting for " << expectedConnections
+              << " subscribed connection(s)" << std::endl;
+    while (exchange.liveCount < expectedConnections) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    static const char *states[] = {"live", "partially_filled", "filled"};
+    std::mt19937_64 random(42);
+    std::exponential_distribution<double> gap(1.0);
+    double burstNanoSec = 1e9 * burst / rate;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    int nextConnection = 0;
+    uint64_t start = bhft::monotonicNanoSec();
+    double due = (double) start;
+    char text[512];
+    for (int first = 0; first < count; first += burst) {
+        while ((double) bhft::monotonicNanoSec() < due) _mm_pause();
+        due += jitter ? burstNanoSec * gap(random) : burstNanoSec;
+        // one write per connection per burst, like several updates landing in one segment
+        std::string out;
+        int last = std::min(count, first + burst);
+        for (int order = first; order < last; ++order) {
+            for (int update = 0; update < updates; ++update) {
+                const char *state = update + 1 == updates && updates > 1 ? states[2] : states[std::min(update, 1)];
+                int size = snprintf(text, sizeof(text),
+                                    R"({"arg":{"channel":"orders","instType":"ANY"},"data":[{"instType":"SPOT",)"
+                                    R"("instId":"BTC-USDT","ordId":"%llu","clOrdId":"","px":"%d.5","sz":"1",)"
+                                    R"("ordType":"limit","side":"%s","state":"%s","uTime":"%llu"}]})",
+                                    (unsigned long long) (MockExchange::firstOrderId + order),
+                                    30000 + order % 1000, order & 1 ? "sell" : "buy", state,
+                                    (unsigned long long) (bhft::wallNanoSec() / 1000000));
+                out += MockExchange::textFrame(std::string(text, size));
+                ++frames;
+            }
+        }
+        auto live = exchange.liveConnections();
+        if (live.empty()) continue;
+        uint64_t now = bhft::monotonicNanoSec();
+        for (int order = first; order < last; ++order) {
+            exchange.sendNanoSec[order].store(now, std::memory_order_release);
+        }
+        if (split) {
+            live[nextConnection++ % live.size()]->send(out);
+            bytes += out.size();
+        } else {
+            for (auto &connection: live) connection->send(out);
+            bytes += out.size() * live.size();
+        }
+    }
+    uint64_t sendNanoSec = std::max<uint64_t>(bhft::monotonicNanoSec() - start, 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(lingerMilliSec));
+
+    // the reader thread is still running: good enough for a report at the end
+    uint64_t unique = 0;
+    uint64_t duplicates = 0;
+    for (uint32_t acks: exchange.acks) {
+        if (acks > 0) ++unique;
+        if (acks > 1) duplicates += acks - 1;
+    }
+    std::stringstream str;
+    str << "Sent orders=" << count << "\tframes=" << frames << "\tbytes=" << bytes << "\tin "
+        << sendNanoSec / 1000 << "us\t" << (uint64_t) (count * 1e9 / sendNanoSec) << " orders/s\n";
+    str << "Responses=" << exchange.responses << "\tunique=" << unique << "\tduplicates=" << duplicates
+        << "\tmissing=" << count - unique << "\tunknown=" << exchange.unknownResponses << "\n";
+    if (unique > 0) {
+        uint64_t ackNanoSec = std::max<uint64_t>(exchange.lastAckNanoSec - exchange.firstAckNanoSec, 1);
+        str << "Round trip ns:\tp50=" << exchange.roundTrip.percentile(0.5) << "\tp90="
+            << exchange.roundTrip.percentile(0.9) << "\tp99=" << exchange.roundTrip.percentile(0.99)
+            << "\tp99.9=" << exchange.roundTrip.percentile(0.999) << "\tmax=" << exchange.roundTrip.max()
+            << "\tacks/s=" << (uint64_t) (unique * 1e9 / ackNanoSec) << "\n";
+    }
+    std::cout << str.str() << std::flush;
+    _exit(0);
+}
@@ -0,0 +1,37 @@
+#include "orders.h"
+
+using namespace bparser;
+
+bool compiledKeys = true;
+
+static constexpr const char *dataObjectId[] = {"ordId",
+                                               "side",
+                                               "px",
+                                               "sz",
+                                               "state",
+                                               "uTime",
+                                               "instId"};
+const char *outputObjectId[] = {"\"orderId\"",
+                                "\"side\"",
+                                "\"price\"",
+                                "\"volume\"",
+                                "\"state\"",
+                                "\"uTime\""};
+
+KeyDfa *dataObjectIdMap = buildStateMachine(dataObjectId, 7);
+
+static constexpr const char *quoteObjectId[] = {"data"};
+KeyDfa *quoteObjectIdMap = buildStateMachine(quoteObjectId, 1);
+
+static constexpr KeyMatcher<7> dataObjectMatcher(dataObjectId);
+static_assert(dataObjectMatcher.found, "no perfect hash for dataObjectId");
+static constexpr KeyMatcher<1> quoteObjectMatcher(quoteObjectId);
+static_assert(quoteObjectMatcher.found, "no perfect hash for quoteObjectId");
+
+int matchDataObjectKey(const char *key, size_t length) {
+    return dataObjectMatcher.match(key, length);
+}
+
+int matchQuoteObjectKey(const char *key, size_t length) {
+    return quoteObjectMatcher.match(key, length);
+}
@@ -0,0 +1,155 @@
+#ifndef HFT_FRAMEWORK_USERDATA_ORDERS_H
+#define HFT_FRAMEWORK_USERDATA_ORDERS_H
+
+#include <stdint.h>
+#include "bparser.h"
+#include "fastsocket.h"
+
+// field names as sent in the response, in dataObjectId order
+extern const char *outputObjectId[6];
+extern bparser::KeyDfa *dataObjectIdMap;
+extern bparser::KeyDfa *quoteObjectIdMap;
+// false matches keys through the runtime DFAs instead of the compiled matchers
+extern bool compiledKeys;
+
+int matchDataObjectKey(const char *key, size_t length);
+
+int matchQuoteObjectKey(const char *key, size_t length);
+
+struct InputData {
+    const char *begin[7];
+    const char *end[7];
+    int mask;
+    // kernel receive timestamp of the message it was parsed from
+    uint64_t rxNanoSec;
+
+    void reset() {
+        mask = 0;
+    }
+
+    uint64_t getId() {
+        uint64_t id = 0;
+        const char *ordBegin = begin[0];
+        const char *ordEnd = end[0];
+        while (ordBegin != ordEnd) {
+            id *= 10;
+            id += (*ordBegin++) - '0';
+        }
+        if (begin[4][1] == 'c') id *= 10;
+        return id;
+    }
+};
+
+struct InputDataSet {
+    static const int capacity = 256;
+    InputData *begin;
+    InputData *end;
+    // one past the last usable slot, the parser keeps a spare slot at end
+    InputData *limit;
+    // orders parsed after the set was full
+    int dropped = 0;
+
+    InputDataSet(InputData *begin, InputData *anEnd, InputData *limit) : begin(begin), end(anEnd), limit(limit) {}
+};
+
+struct DataObjectCallback final : bparser::ObjectCallback {
+    bhft::WebSocket *ws;
+    InputDataSet &inputDataSet;
+    InputData *currentInput;
+
+    explicit DataObjectCallback(bhft::WebSocket *ws, InputDataSet &inputDataSet)
+            : bparser::ObjectCallback(dataObjectIdMap, compiledKeys ? matchDataObjectKey : nullptr), ws(ws),
+              inputDataSet(inputDataSet), currentInput(inputDataSet.end) {
+        currentInput->reset();
+    }
+
+    uint64_t ctol(const char *str_begin, const char *str_end) {
+        uint64_t ans = 0;
+        ++str_begin;
+        --str_end;
+        while (str_begin != str_end) {
+            ans *= 10;
+            ans += (*str_begin++) - '0';
+        }
+        return ans;
+    }
+
+    void valueForField(int fieldId, const char *begin, const char *end) override {
+        if (fieldId < 0) return;
+        if (fieldId == 0) {
+            ++begin;
+            --end;
+        }
+        currentInput->begin[fieldId] = begin;
+        currentInput->end[fieldId] = end;
+        currentInput->mask |= 1 << fieldId;
+    }
+
+    bparser::ObjectCallback *willParseObject(int field_id) override {
+        return nullptr;
+    }
+
+    bparser::ArrayCallback *willParseArray(int field_id) override {
+        return nullptr;
+    }
+
+    void objectFinished() override {
+        if (currentInput->mask != 0) { // TODO check all required fields
+            if (inputDataSet.end + 1 != inputDataSet.limit) {
+                currentInput = ++inputDataSet.end;
+            } else {
+                ++inputDataSet.dropped;
+            }
+        }
+        currentInput->reset();
+    }
+};
+
+
+struct DataArrayCallback final : bparser::ArrayCallback {
+    DataObjectCallback dataObjectCallback;
+
+    explicit DataArrayCallback(bhft::WebSocket *ws, InputDataSet &inputDataSet) : dataObjectCallback(ws,
+                                                                                                     inputDataSet) {}
+
+    bparser::ArrayCallback *willParseArray() override {
+        return nullptr;
+    }
+
+    DataObjectCallback *willParseObject() override {
+        return &dataObjectCallback;
+    }
+
+    void nextValue(const char *begin, const char *end) override {
+
+    }
+
+    void arrayFinished() override {
+
+    }
+};
+
+struct QuoteObjectCallback final : bparser::ObjectCallback {
+    DataArrayCallback dataArrayCallback;
+
+    explicit QuoteObjectCallback(bhft::WebSocket *ws, InputDataSet &inputDataSet)
+            : bparser::ObjectCallback(quoteObjectIdMap, compiledKeys ? matchQuoteObjectKey : nullptr),
+              dataArrayCallback(ws, inputDataSet) {}
+
+    void valueForField(int field_id, const char *begin, const char *end) override {
+    }
+
+    bparser::ObjectCallback *willParseObject(int fieldId) override {
+        return nullptr;
+    }
+
+    DataArrayCallback *willParseArray(int field_id) override {
+        return field_id == 0 ? &dataArrayCallback : nullptr;
+    }
+
+    void objectFinished() override {
+
+    }
+};
+
+#endif //HFT_FRAMEWORK_USERDATA_ORDERS_H
@@ -0,0 +1,131 @@
+#include "pipeline.h"
+#include <iostream>
+#include <sstream>
+
+bool logEnabled = false;
+bool maskEnabled = true;
+bool lockFreeDedup = true;
+bool structuralScan = true;
+bool staticCallbacks = true;
+
+ThreadSync threadSync;
+
+void reportHistogram(std::stringstream &str, int id, const char *stage, const bhft::Histogram &histogram) {
+    uint64_t count = histogram.count();
+    if (count == 0) return;
+    str << id << "\tLatency ns:\t" << stage << "\tcount=" << count << "\tp50=" << histogram.percentile(0.5)
+        << "\tp90=" << histogram.percentile(0.9) << "\tp99=" << histogram.percentile(0.99) << "\tp99.9="
+        << histogram.percentile(0.999) << "\tmax=" << histogram.max() << "\n";
+}
+
+// Cumulative since start for every connection of slot id, reading never stalls their writers.
+void reportPipelineStats(int id, const PipelineStats &stats) {
+    std::stringstream str;
+    reportHistogram(str, id, "decode", stats.decode);
+    reportHistogram(str, id, "parse", stats.parse);
+    reportHistogram(str, id, "dedup", stats.dedup);
+    reportHistogram(str, id, "send", stats.send);
+    reportHistogram(str, id, "wire", stats.wire);
+    uint64_t dropped = stats.droppedOrders.load(std::memory_order_relaxed);
+    if (dropped != 0) str << id << "\tDropped orders:\t" << dropped << "\n";
+    std::cout << str.str() << std::flush;
+}
+
+void reportWaitStats(int id, const bhft::WaitStats &stats) {
+    std::stringstream str;
+    str << id << "\tWait stats:\timmediate=" << stats.immediate << "\tspin=" << stats.spin << "\tsleep="
+        << stats.sleep << "\tblock=" << stats.block << "\tbusyPoll=" << stats.busyPoll << std::endl;
+    std::cout << str.str();
+}
+
+void reportSendStats(int id, const bhft::SendStats &stats) {
+    std::stringstream str;
+    str << id << "\tSend stats:\tparked=" << stats.parked << "\tmaxQueued=" << stats.maxDepth << "\tblocked="
+        << stats.blocked << "\tblockedMicroSec=" << stats.blockedNanoSec / 1000 << std::endl;
+    std::cout << str.str();
+}
+
+void reportLockStats(const char *name, const LockStats &stats) {
+    uint64_t acquired = stats.acquireWait.count();
+    if (acquired == 0) return;
+    std::stringstream str;
+    str << name << " lock stats:\tacquired=" << acquired << "\tcontended=" << stats.contended
+        << "\twaitP50Ns=" << stats.acquireWait.percentile(0.5) << "\twaitP99Ns=" << stats.acquireWait.percentile(0.99)
+        << "\tholdP50Ns=" << stats.hold.percentile(0.5) << "\tholdP99Ns=" << stats.hold.percentile(0.99)
+        << std::endl;
+    std::cout << str.str();
+}
+
+void reportDedupStats(const bhft::DedupSet::Stats &stats) {
+    std::stringstream str;
+    str << "Dedup stats:\tclaims=" << stats.claims << "\tduplicates=" << stats.duplicates << "\texpired="
+        << stats.expired << "\tprematureEvictions=" << stats.prematureEvictions << std::endl;
+    std::cout << str.str();
+}
+
+bhft::status forwardInputsLocked(HFTSocket &hftSocket, InputDataSet &inputDataSet, int &fine, int iter,
+                                 int skipFine) {
+    // one lock and one send for everything read in this batch
+    uint64_t lockStart = bhft::tscTicks();
+    Mutex mutex(threadSync.locker);
+    hftSocket.stats.dedup.record(bhft::ticksToNanoSec(bhft::tscTicks() - lockStart));
+    InputData *forwarded[InputDataSet::capacity];
+    int forwardedCount = 0;
+    hftSocket.ws.cork();
+    for (auto input = inputDataSet.begin; input != inputDataSet.end; ++input) {
+        uint64_t inputId = input->getId();
+        int cnt = threadSync.getCount(inputId);
+        if (cnt > 0) {
+            if (iter > skipFine) {
+                fine += (1 << (cnt - 1)) - 1;
+            }
+            continue;
+        }
+        if (hftSocket.writeMessage(*input) == bhft::closed) {
+            return bhft::closed;
+        }
+        threadSync.add(inputId);
+        forwarded[forwardedCount++] = input;
+    }
+    uint64_t sendStart = bhft::tscTicks();
+    bhft::status stat = hftSocket.ws.flush();
+    hftSocket.stats.send.record(bhft::ticksToNanoSec(bhft::tscTicks() - sendStart));
+    if (stat == bhft::success) hftSocket.trackForwarded(forwarded, forwardedCount);
+    return stat;
+}
+
+bhft::status forwardInputs(HFTSocket &hftSocket, InputDataSet &inputDataSet, int &fine, int iter, int skipFine) {
+    if (inputDataSet.begin == inputDataSet.end) return bhft::success;
+    if (!lockFreeDedup) return forwardInputsLocked(hftSocket, inputDataSet, fine, iter, skipFine);
+    InputData *claimed[InputDataSet::capacity];
+    int claimedCount = 0;
+    bhft::status stat = bhft::success;
+    hftSocket.ws.cork();
+    for (auto input = inputDataSet.begin; input != inputDataSet.end && stat == bhft::success; ++input) {
+        uint64_t inputId = input->getId();
+        uint64_t dedupStart = bhft::tscTicks();
+        uint32_t cnt = threadSync.orders.claim(inputId);
+        hftSocket.stats.dedup.record(bhft::ticksToNanoSec(bhft::tscTicks() - dedupStart));
+        if (cnt > 0) {
+            if (iter > skipFine) {
+                fine += (1 << (cnt - 1)) - 1;
+            }
+            continue;
+        }
+        claimed[claimedCount++] = input;
+        stat = hftSocket.writeMessage(*input);
+    }
+    if (stat == bhft::success && claimedCount > 0) {
+        uint64_t sendStart = bhft::tscTicks();
+        stat = hftSocket.ws.flush();
+        hftSocket.stats.send.record(bhft::ticksToNanoSec(bhft::tscTicks() - sendStart));
+        if (stat == bhft::success) hftSocket.trackForwarded(claimed, claimedCount);
+    } else if (stat == bhft::success) {
+        stat = hftSocket.ws.flush();
+    }
+    if (stat == bhft::closed) {
+        // corked frames may not have left: let the other connections forward them
+        for (int i = 0; i < claimedCount; ++i) threadSync.orders.abandon(claimed[i]->getId());
+    }
+    return stat;
+}
@@ -0,0 +1,330 @@
+#ifndef HFT_FRAMEWORK_USERDATA_PIPELINE_H
+#define HFT_FRAMEWORK_USERDATA_PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <immintrin.h>
+#include "fastsocket.h"
+#include "responsetemplate.h"
+#include "dedupset.h"
+#include "tscclock.h"
+#include "histogram.h"
+#include "logger.h"
+#include "journal.h"
+#include "orders.h"
+
+extern bool logEnabled;
+// RFC 6455 requires clients to mask, a local proxy may accept unmasked frames
+extern bool maskEnabled;
+// false falls back to the 128 entry history scanned under threadSync.locker
+extern bool lockFreeDedup;
+// false parses byte by byte without building a StructuralIndex first
+extern bool structuralScan;
+// false parses through the virtual ObjectCallback interface instead of the
+// callback types compiled into the parser
+extern bool staticCallbacks;
+
+struct TimeMeasurer {
+    uint64_t startTicks;
+
+    TimeMeasurer() : startTicks(bhft::tscTicks()) {}
+
+    void reset() {
+        startTicks = bhft::tscTicks();
+    }
+
+    uint64_t elapsedNanoSec() {
+        return bhft::ticksToNanoSec(bhft::tscTicks() - startTicks);
+    }
+
+    uint64_t elapsedMicroSec() {
+        return elapsedNanoSec() / 1000;
+    }
+
+    uint64_t elapsedMilliSec() {
+        return elapsedMicroSec() / 1000;
+    }
+};
+
+struct LockStats {
+    std::atomic<uint64_t> contended{0};
+    bhft::Histogram acquireWait;
+    bhft::Histogram hold;
+};
+
+// Where a connection's time goes, in nanoseconds: bytes received to frames
+// decoded, JSON parse per message, dedup per order and the send of a batch.
+// Written only by the connection's thread, read by the reporter.
+struct PipelineStats {
+    bhft::Histogram decode;
+    bhft::Histogram parse;
+    bhft::Histogram dedup;
+    bhft::Histogram send;
+    // kernel rx timestamp to kernel tx timestamp, with timestamping=true
+    bhft::Histogram wire;
+    // orders that found their InputDataSet full
+    std::atomic<uint64_t> droppedOrders{0};
+};
+
+// Test-and-test-and-set: waiters spin on a plain load of their cached copy
+// and only try the exchange once the lock looks free, backing off
+// exponentially (bounded) with pause in between.
+class SpinLock {
+    const int UNLOCKED = 0;
+    const int LOCKED = 1;
+    static constexpr int maxBackoff = 1024;
+
+    alignas(64) std::atomic<int> m_value = 0;
+
+public:
+    // Written only while the lock is held, so plain single-writer stores do;
+    // on its own line, away from the word waiters spin on.
+    alignas(64) LockStats stats;
+
+    void lock() {
+        if (m_value.exchange(LOCKED, std::memory_order_acquire) == UNLOCKED) {
+            stats.acquireWait.record(0);
+            return;
+        }
+        uint64_t start = bhft::tscTicks();
+        int backoff = 1;
+        while (true) {
+            while (m_value.load(std::memory_order_relaxed) == LOCKED) {
+                for (int i = 0; i < backoff; ++i) _mm_pause();
+                backoff = std::min(backoff * 2, maxBackoff);
+            }
+            if (m_value.exchange(LOCKED, std::memory_order_acquire) == UNLOCKED) break;
+        }
+        uint64_t waited = bhft::ticksToNanoSec(bhft::tscTicks() - start);
+        stats.contended.store(stats.contended.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        stats.acquireWait.record(waited);
+    }
+
+    void unlock() {
+        m_value.store(UNLOCKED, std::memory_order_release);
+    }
+};
+
+struct Mutex {
+    SpinLock &spinLock;
+    uint64_t acquiredAt;
+
+    Mutex(SpinLock &spinLock) : spinLock(spinLock) {
+        spinLock.lock();
+        acquiredAt = bhft::tscTicks();
+    }
+
+    virtual ~Mutex() {
+        uint64_t held = bhft::tscTicks() - acquiredAt;
+        spinLock.stats.hold.record(bhft::ticksToNanoSec(held));
+        spinLock.unlock();
+    }
+};
+
+struct ThreadSync {
+    static const int dataSize = 128;
+    volatile uint64_t data[dataSize];
+    volatile int count[dataSize];
+    volatile int index;
+    SpinLock locker;
+    // one slot per redundant connection, main rejects a larger logLevel
+    static constexpr int maxThreads = 32;
+    volatile bhft::socket_t socket[maxThreads];
+    bhft::DedupSet orders;
+    PipelineStats pipeline[maxThreads];
+    // inbound frame capture per thread, with journal=<prefix>
+    bhft::Journal journal[maxThreads];
+    bhft::JournalRoller journalRoller;
+
+    bhft::Journal *journalFor(int threadId) {
+        return journal[threadId].active != nullptr ? &journal[threadId] : nullptr;
+    }
+
+    int getCount(uint64_t id) {
+        for (int i = 0; i < dataSize; ++i) {
+            if (data[i] == id) return count[i]++;
+        }
+        return 0;
+    }
+
+    void add(uint64_t id) {
+        count[index] = 1;
+        data[index++] = id;
+        index %= dataSize;
+    }
+};
+
+extern ThreadSync threadSync;
+
+struct HFTSocket {
+    // free InputDataSet slots needed to parse another frame of a batch
+    static const int messageHeadroom = 16;
+
+    bhft::WebSocket ws;
+    char buffer[65536];
+    int id;
+    bhft::ResponseTemplate response;
+    PipelineStats &stats;
+    bhft::Journal *journal;
+    bparser::StructuralIndex structurals;
+    // the last decoded batch; frames from next on wait in the ring while the
+    // caller's InputDataSet is short of room
+    bhft::MessageBatch batch;
+    int next = 0;
+    char *scratch = buffer;
+
+    HFTSocket(int id, const bhft::SocketOptions &options, PipelineStats &stats, bhft::Journal *journal) : ws("127.0.0.1", 9999,
+                                                                        "?url=wss://ws.okx.com:8443/ws/v5/private",
+                                                                        maskEnabled, options), id(id),
+                                                                     response(outputObjectId, 6,
+                                                                              R"(,"apiKey":"xNEkpMtgh6lF7v8K","sign":"SkAjqP4LC9UexmrX"})"),
+                                                                     stats(stats), journal(journal) {}
+
+    bool isClosed() {
+        return ws.isClosed();
+    }
+
+    bhft::status login() {
+        bhft::OutputMessage &message = ws.getOutputMessage();
+        const auto p1 = std::chrono::system_clock::now();
+        int timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+                p1.time_since_epoch()).count();
+
+        sprintf(buffer,
+                R"({"op":"login","args":[{"apiKey":"xNEkpMtgh6lF7v8K","passphrase":"","timestamp":%i,"sign":"SkAjqP4LC9UexmrX"}]})",
+                timestamp);
+        message.write(buffer);
+        if (ws.sendLastOutputMessage(bhft::wsheader_type::TEXT_FRAME) == bhft::closed) {
+            return bhft::closed;
+        }
+        bhft::Message inMessage1(buffer, sizeof(buffer));
+        if (ws.getMessage(inMessage1) == bhft::closed) {
+            return bhft::closed;
+        }
+        auto start = std::chrono::system_clock::now();
+        capture(inMessage1);
+        bhft::logger.log(bhft::logLogin, id, 0, inMessage1.begin, inMessage1.end - inMessage1.begin);
+        return bhft::success;
+    }
+
+    bhft::status subscribe(std::string &subscribeMessage) {
+        bhft::OutputMessage &message2 = ws.getOutputMessage();
+        message2.write(subscribeMessage.c_str());
+        if (ws.sendLastOutputMessage(bhft::wsheader_type::TEXT_FRAME) == bhft::closed) {
+            return bhft::closed;
+        }
+        bhft::Message inMessage2(buffer, sizeof(buffer));
+        if (ws.getMessage(inMessage2) == bhft::closed) {
+            return bhft::closed;
+        }
+        capture(inMessage2);
+        bhft::logger.log(bhft::logSubscribe, id, 0, inMessage2.begin, inMessage2.end - inMessage2.begin);
+        return bhft::success;
+    }
+
+    // Journals the frame as decoded, before any fixups.
+    void capture(const bhft::Message &message) {
+        if (journal == nullptr) return;
+        journal->append(id, ws.socket.lastReceiveTicks, message.rxNanoSec, message.begin,
+                        message.end - message.begin);
+    }
+
+    // Call after a flush: ties the forwarded inputs to the bytes just written
+    // and records wire-in to wire-out for sends the kernel has stamped.
+    void trackForwarded(InputData **forwarded, int count) {
+        if (!ws.socket.timestamping) return;
+        for (int i = 0; i < count; ++i) ws.socket.trackTx(forwarded[i]->rxNanoSec);
+        ws.socket.readErrorQueue();
+        for (int i = 0; i < ws.socket.wireLatencyCount; ++i) stats.wire.record(ws.socket.wireLatencies[i]);
+        ws.socket.wireLatencyCount = 0;
+    }
+
+    // Parses one decoded frame into inputDataSet, false if it held no usable object.
+    // Views needing the brace fixups are copied to scratch, which then advances.
+    bool parseMessage(bhft::Message &inMessage, InputDataSet &inputDataSet, char *&scratch) {
+        if (inMessage.begin == inMessage.end) return false;
+        if (inMessage.view && (*inMessage.begin != '{' || inMessage.end[-1] != '}')) {
+            // the fixups below would overwrite neighbouring frames in the ring
+            size_t size = inMessage.end - inMessage.begin;
+            if (size + 3 > (size_t) (buffer + sizeof(buffer) - scratch)) return false;
+            memcpy(scratch + 1, inMessage.begin, size);
+            inMessage = bhft::Message(scratch + 1);
+            inMessage.end += size;
+            scratch = inMessage.end + 1;
+        }
+        if (*inMessage.begin != '{') *--inMessage.begin = '{';
+        if (inMessage.end[-1] != '}') *inMessage.end++ = '}';
+        QuoteObjectCallback quoteObjectCallback(&ws, inputDataSet);
+        InputData *firstParsed = inputDataSet.end;
+        uint64_t parseStart = bhft::tscTicks();
+        bool indexed = structuralScan && structurals.build(inMessage.begin, inMessage.end);
+        bparser::input in(inMessage, indexed ? &structurals : nullptr);
+        int parseResult = staticCallbacks ? in.parseObject(&quoteObjectCallback)
+                                          : in.parseObject<bparser::ObjectCallback>(&quoteObjectCallback);
+        stats.parse.record(bhft::ticksToNanoSec(bhft::tscTicks() - parseStart));
+        for (auto input = firstParsed; input != inputDataSet.end; ++input) {
+            input->rxNanoSec = inMessage.rxNanoSec;
+        }
+        return parseResult != -2;
+    }
+
+    bhft::status readMessage(InputDataSet &inputDataSet, bool returnOnNoData = false) {
+        bool parsed = false;
+        while (true) {
+            if (next == batch.count) {
+                next = 0;
+                auto stat = ws.getMessages(batch, buffer + 1, sizeof(buffer) - 2, returnOnNoData);
+                if (stat != bhft::success) return stat;
+                stats.decode.record(bhft::ticksToNanoSec(bhft::tscTicks() - ws.socket.lastReceiveTicks));
+                // copies of views that need fixups go after the first message
+                scratch = batch.messages[0].view ? buffer : batch.messages[0].end + 1;
+            }
+            for (; next < batch.count; ++next) {
+                if (parsed && inputDataSet.limit - inputDataSet.end < messageHeadroom) break;
+                bhft::Message &inMessage = batch.messages[next];
+                capture(inMessage);
+                if (logEnabled) {
+                    bhft::logger.log(bhft::logArrived, id, 0, inMessage.begin, inMessage.end - inMessage.begin);
+                }
+                if (parseMessage(inMessage, inputDataSet, scratch)) parsed = true;
+            }
+            if (parsed) break;
+        }
+        if (inputDataSet.dropped != 0) {
+            stats.droppedOrders.store(stats.droppedOrders.load(std::memory_order_relaxed) + inputDataSet.dropped,
+                                      std::memory_order_relaxed);
+        }
+        return bhft::success;
+    }
+
+    bhft::status writeMessage(const InputData &input) {
+        iovec parts[bhft::ResponseTemplate::maxParts];
+        int count = response.gather(parts, input.begin, input.end, input.mask);
+        if (ws.sendFrame(bhft::wsheader_type::TEXT_FRAME, parts, count) == bhft::closed) {
+            return bhft::closed;
+        }
+        if (logEnabled) {
+            bhft::logger.log(bhft::logSending, id, 0, input.begin[0], input.end[0] - input.begin[0]);
+        }
+        return bhft::success;
+    }
+};
+
+void reportPipelineStats(int id, const PipelineStats &stats);
+
+void reportWaitStats(int id, const bhft::WaitStats &stats);
+
+void reportSendStats(int id, const bhft::SendStats &stats);
+
+void reportLockStats(const char *name, const LockStats &stats);
+
+void reportDedupStats(const bhft::DedupSet::Stats &stats);
+
+bhft::status forwardInputsLocked(HFTSocket &hftSocket, InputDataSet &inputDataSet, int &fine, int iter,
+                                 int skipFine);
+
+bhft::status forwardInputs(HFTSocket &hftSocket, InputDataSet &inputDataSet, int &fine, int iter, int skipFine);
+
+#endif //HFT_FRAMEWORK_USERDATA_PIPELINE_H
@@ -0,0 +1,89 @@
+#include "reactor.h"
+#include <algorithm>
+
+namespace bhft {
+
+    Reactor::Reactor() : epollFd(epoll_create1(EPOLL_CLOEXEC)) {
+        if (epollFd < 0) {
+            perror("epoll_create1");
+        }
+    }
+
+    Reactor::~Reactor() {
+        if (epollFd >= 0) ::close(epollFd);
+    }
+
+    bool Reactor::add(socket_t socket, Handler *handler) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.ptr = handler;
+        return epoll_ctl(epollFd, EPOLL_CTL_ADD, socket, &event) == 0;
+    }
+
+    void Reactor::remove(socket_t socket) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, socket, nullptr);
+    }
+
+    bool Reactor::addShared(socket_t socket, Handler *handler) {
+        SharedHandler &entry = shared[socket];
+        if (entry.members.empty() && !add(socket, &entry)) return false;
+        entry.members.push_back(handler);
+        return true;
+    }
+
+    void Reactor::removeShared(socket_t socket, Handler *handler) {
+        auto found = shared.find(socket);
+        if (found == shared.end()) return;
+        std::vector<Handler *> &members = found->second.members;
+        members.erase(std::remove(members.begin(), members.end(), handler), members.end());
+        // the entry stays: removal may happen from inside its onReadable
+        if (members.empty()) remove(socket);
+    }
+
+    status Reactor::SharedHandler::onReadable() {
+        // backwards, a member that closes removes itself from the vector
+        for (size_t i = members.size(); i > 0; --i) {
+            Handler *handler = members[i - 1];
+            if (handler->onReadable() == closed) handler->onClosed();
+        }
+        return success;
+    }
+
+    status Reactor::SharedHandler::onWritable() {
+        return success;
+    }
+
+    void Reactor::SharedHandler::onClosed() {}
+
+    bool Reactor::watchWritable(socket_t readSocket, socket_t writeSocket, Handler *handler, bool enable) {
+        epoll_event event{};
+        event.data.ptr = handler;
+        if (readSocket == writeSocket) {
+            event.events = EPOLLIN | EPOLLRDHUP | (enable ? (uint32_t) EPOLLOUT : 0u);
+            return epoll_ctl(epollFd, EPOLL_CTL_MOD, readSocket, &event) == 0;
+        }
+        event.events = EPOLLOUT;
+        return epoll_ctl(epollFd, enable ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, writeSocket, &event) == 0;
+    }
+
+    int Reactor::poll(int timeoutMs) {
+        epoll_event events[maxEvents];
+        int count = epoll_wait(epollFd, events, maxEvents, timeoutMs);
+        if (count < 0) {
+            return errno == EINTR ? 0 : -1;
+        }
+        for (int i = 0; i < count; ++i) {
+            auto *handler = static_cast<Handler *>(events[i].data.ptr);
+            uint32_t ready = events[i].events;
+            if ((ready & EPOLLOUT) && handler->onWritable() == closed) {
+                handler->onClosed();
+                continue;
+            }
+            if ((ready & ~EPOLLOUT) && handler->onReadable() == closed) {
+                handler->onClosed();
+            }
+        }
+        return count;
+    }
+
+} // bhft
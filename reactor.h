@@ -0,0 +1,65 @@
+#ifndef HFT_FRAMEWORK_USERDATA_REACTOR_H
+#define HFT_FRAMEWORK_USERDATA_REACTOR_H
+
+#include <sys/epoll.h>
+#include <map>
+#include <vector>
+#include "fastsocket.h"
+
+namespace bhft {
+
+    // Owns a set of sockets and wakes only when one of them becomes readable
+    // (or writable, while it has output queued).
+    // Handlers are called from the thread that runs poll().
+    struct Reactor {
+        struct Handler {
+            // Called when the socket is readable. Must consume everything that is
+            // already buffered, returning closed removes the socket from the reactor.
+            virtual status onReadable() = 0;
+
+            // Called when a socket with queued output can take more.
+            virtual status onWritable() = 0;
+
+            virtual void onClosed() = 0;
+        };
+
+        // Handlers behind one descriptor, the connections of a thread's
+        // io_uring: a wakeup calls every one of them, most find nothing to do.
+        struct SharedHandler : Handler {
+            std::vector<Handler *> members;
+
+            status onReadable() override;
+
+            status onWritable() override;
+
+            void onClosed() override;
+        };
+
+        static const int maxEvents = 64;
+
+        int epollFd;
+        std::map<socket_t, SharedHandler> shared;
+
+        Reactor();
+
+        ~Reactor();
+
+        bool add(socket_t socket, Handler *handler);
+
+        void remove(socket_t socket);
+
+        // add() for a descriptor other handlers may be registered with too.
+        bool addShared(socket_t socket, Handler *handler);
+
+        void removeShared(socket_t socket, Handler *handler);
+
+        // Starts or stops EPOLLOUT notifications for writeSocket. When it is not
+        // the descriptor passed to add() (io_uring) it gets its own registration.
+        bool watchWritable(socket_t readSocket, socket_t writeSocket, Handler *handler, bool enable);
+
+        int poll(int timeoutMs);
+    };
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_REACTOR_H
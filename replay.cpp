@@ -0,0 +1,185 @@
+// Feeds frames captured with journal=<prefix> through the parser, the dedup
+// and the response serialization of the live client, with sends going to
+// memory instead of a socket:
+//   replay journal=<prefix> [pacing=fast|recorded] [dedup=spinlock] [mask=false]
+//          [dedupSize=N] [dedupWindow=ms] [keys=dfa] [scan=bytes] [scanKernel=scalar|avx2|avx512]
+//          [callbacks=virtual] [tsc=false]
+
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+#include "pipeline.h"
+
+struct Frame {
+    uint64_t receiveTicks;
+    uint64_t rxNanoSec;
+    // receiveTicks in nanoseconds of the recording clock
+    uint64_t receiveNanoSec;
+    int slot;
+    int connectionId;
+    const char *data;
+    uint32_t length;
+};
+
+static bool loadSegment(const char *path, std::vector<Frame> &frames) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(bhft::Journal::FileHeader)) {
+        ::close(fd);
+        return false;
+    }
+    // stays mapped until exit, frames point into it
+    auto *data = static_cast<char *>(::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+    auto *header = reinterpret_cast<const bhft::Journal::FileHeader *>(data);
+    if (memcmp(header->magic, "BHFTJRNL", 8) != 0 || header->version != bhft::Journal::version) {
+        std::cout << path << ": not a journal segment" << std::endl;
+        return false;
+    }
+    size_t position = sizeof(bhft::Journal::FileHeader);
+    while (position + sizeof(bhft::Journal::RecordHeader) <= (size_t) st.st_size) {
+        auto *record = reinterpret_cast<const bhft::Journal::RecordHeader *>(data + position);
+        if (record->length == 0) break;
+        position += sizeof(bhft::Journal::RecordHeader);
+        if (position + record->length > (size_t) st.st_size) break;
+        Frame frame{};
+        frame.receiveTicks = record->receiveTicks;
+        frame.rxNanoSec = record->rxNanoSec;
+        frame.receiveNanoSec = (uint64_t) ((double) (record->receiveTicks - header->baseTicks) /
+                                           header->ticksPerNanoSec);
+        frame.slot = header->slot;
+        frame.connectionId = record->connectionId;
+        frame.data = data + position;
+        frame.length = record->length;
+        frames.push_back(frame);
+        position += (record->length + 7) & ~(size_t) 7;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    std::map<std::string, std::string> map;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        size_t index = arg.find('=');
+        if (index == std::string::npos) return -1;
+        map[arg.substr(0, index)] = arg.substr(index + 1);
+    }
+    if (map["journal"].empty()) {
+        std::cout << "Usage: replay journal=<prefix> [pacing=fast|recorded] [dedup=spinlock] [mask=false]"
+                  << std::endl;
+        return -1;
+    }
+    if (map["tsc"] == "false") bhft::tscClock.disableTsc();
+    if (map["mask"] == "false") maskEnabled = false;
+    if (map["dedup"] == "spinlock") lockFreeDedup = false;
+    if (map["keys"] == "dfa") compiledKeys = false;
+    if (map["scan"] == "bytes") structuralScan = false;
+    if (map["callbacks"] == "virtual") staticCallbacks = false;
+    if (map.find("scanKernel") != map.end() && !bparser::selectScanKernel(map["scanKernel"].c_str())) {
+        std::cout << "Unsupported scan kernel " << map["scanKernel"] << ", using " << bparser::scanKernelName()
+                  << std::endl;
+    }
+    bool recordedPacing = map["pacing"] == "recorded";
+    threadSync.orders.init(map.find("dedupSize") != map.end() ? stoul(map["dedupSize"]) : 1 << 18,
+                           map.find("dedupWindow") != map.end() ? stoul(map["dedupWindow"]) : 5000);
+
+    glob_t paths{};
+    std::string pattern = map["journal"] + ".*.journal";
+    if (::glob(pattern.c_str(), 0, nullptr, &paths) != 0) {
+        std::cout << "No segments match " << pattern << std::endl;
+        return -1;
+    }
+    std::vector<Frame> frames;
+    for (size_t i = 0; i < paths.gl_pathc; ++i) loadSegment(paths.gl_pathv[i], frames);
+    globfree(&paths);
+    // every slot recorded the same TSC, so this is arrival order across connections
+    std::stable_sort(frames.begin(), frames.end(), [](const Frame &a, const Frame &b) {
+        return a.receiveTicks < b.receiveTicks;
+    });
+    if (frames.empty()) {
+        std::cout << "No frames in " << pattern << std::endl;
+        return -1;
+    }
+
+    bhft::SocketOptions options;
+    options.transport = bhft::inMemory;
+    options.ringSize = 4096;
+    HFTSocket *sockets[ThreadSync::maxThreads] = {};
+    InputData inputData[InputDataSet::capacity];
+    bhft::Histogram frameLatency;
+    uint64_t parsedCount = 0;
+    uint64_t skipped = 0;
+    int fine = 0;
+    uint64_t firstNanoSec = frames.front().receiveNanoSec;
+    uint64_t startNanoSec = bhft::monotonicNanoSec();
+    for (const Frame &frame: frames) {
+        if (frame.slot < 0 || frame.slot >= ThreadSync::maxThreads) {
+            ++skipped;
+            continue;
+        }
+        HFTSocket *&hftSocket = sockets[frame.slot];
+        if (hftSocket == nullptr) {
+            hftSocket = new HFTSocket(frame.connectionId, options, threadSync.pipeline[frame.slot], nullptr);
+        }
+        if (frame.length + 3 > sizeof(hftSocket->buffer)) {
+            ++skipped;
+            continue;
+        }
+        if (recordedPacing) {
+            uint64_t due = startNanoSec + (frame.receiveNanoSec - firstNanoSec);
+            while (bhft::monotonicNanoSec() < due) _mm_pause();
+        }
+        uint64_t frameStart = bhft::tscTicks();
+        // the copy stands in for the receive, the parser fixes up frames in place
+        memcpy(hftSocket->buffer + 1, frame.data, frame.length);
+        bhft::Message message(hftSocket->buffer + 1);
+        message.end += frame.length;
+        message.rxNanoSec = frame.rxNanoSec;
+        char *scratch = message.end + 1;
+        InputDataSet inputDataSet(inputData, inputData, inputData + InputDataSet::capacity);
+        hftSocket->parseMessage(message, inputDataSet, scratch);
+        parsedCount += inputDataSet.end - inputDataSet.begin;
+        forwardInputs(*hftSocket, inputDataSet, fine, 1, 0);
+        frameLatency.record(bhft::ticksToNanoSec(bhft::tscTicks() - frameStart));
+    }
+    uint64_t elapsedNanoSec = std::max<uint64_t>(bhft::monotonicNanoSec() - startNanoSec, 1);
+
+    uint64_t outputBytes = 0;
+    for (int i = 0; i < ThreadSync::maxThreads; ++i) {
+        if (sockets[i] == nullptr) continue;
+        outputBytes += sockets[i]->ws.socket.streamOffset;
+        reportPipelineStats(i, sockets[i]->stats);
+    }
+    std::stringstream str;
+    uint64_t replayed = frames.size() - skipped;
+    str << "Replayed " << replayed << " frames (" << skipped << " skipped) in " << elapsedNanoSec / 1000
+        << "us, " << std::fixed << std::setprecision(0) << replayed * 1e9 / elapsedNanoSec << " msg/s, pacing "
+        << (recordedPacing ? "recorded" : "fast") << "\n";
+    str << "Orders parsed=" << parsedCount << "\toutputBytes=" << outputBytes << "\n";
+    str << "Frame ns:\tp50=" << frameLatency.percentile(0.5) << "\tp99=" << frameLatency.percentile(0.99)
+        << "\tp99.9=" << frameLatency.percentile(0.999) << "\tmax=" << frameLatency.max() << "\n";
+    std::cout << str.str();
+    if (lockFreeDedup) {
+        reportDedupStats(threadSync.orders.stats);
+    } else {
+        reportLockStats("Dedup", threadSync.locker.stats);
+    }
+    return 0;
+}
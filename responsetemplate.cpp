@@ -0,0 +1,36 @@
+#include "responsetemplate.h"
+
+#include <utility>
+
+namespace bhft {
+
+    static const char openingBrace[] = "{";
+
+    ResponseTemplate::ResponseTemplate(const char **keys, int count, std::string suffix) : suffix(std::move(suffix)),
+                                                                                             fieldCount(count < maxFields ? count : maxFields) {
+        for (int i = 0; i < fieldCount; ++i) {
+            fieldPrefix[i] = std::string(",") + keys[i] + ":";
+            firstFieldPrefix[i] = std::string("{") + keys[i] + ":";
+        }
+    }
+
+    int ResponseTemplate::gather(iovec *parts, const char *const *begin, const char *const *end, int mask) const {
+        int count = 0;
+        for (int i = 0; i < fieldCount; ++i) {
+            if ((mask >> i) & 1) {
+                const std::string &prefix = count == 0 ? firstFieldPrefix[i] : fieldPrefix[i];
+                parts[count++] = {const_cast<char *>(prefix.data()), prefix.size()};
+                parts[count++] = {const_cast<char *>(begin[i]), (size_t) (end[i] - begin[i])};
+            }
+        }
+        if (count == 0) {
+            // no fields: the brace replaces the suffix's leading comma
+            parts[count++] = {const_cast<char *>(openingBrace), 1};
+            parts[count++] = {const_cast<char *>(suffix.data()) + 1, suffix.size() - 1};
+        } else {
+            parts[count++] = {const_cast<char *>(suffix.data()), suffix.size()};
+        }
+        return count;
+    }
+
+} // bhft
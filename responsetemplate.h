@@ -0,0 +1,34 @@
+#ifndef HFT_FRAMEWORK_USERDATA_RESPONSETEMPLATE_H
+#define HFT_FRAMEWORK_USERDATA_RESPONSETEMPLATE_H
+
+#include <string>
+#include "fastsocket.h"
+
+namespace bhft {
+
+    // Constant skeleton of an outgoing JSON object: one `,"key":` segment per
+    // field (and a `{"key":` variant for the first one) and a fixed suffix
+    // with the closing brace. Built once, sending only points at the
+    // precomputed segments around the field values.
+    struct ResponseTemplate {
+        static const int maxFields = 8;
+        static const int maxParts = 2 * maxFields + 2;
+
+        std::string fieldPrefix[maxFields];
+        std::string firstFieldPrefix[maxFields];
+        std::string suffix;
+        int fieldCount;
+
+        // keys are quoted JSON keys, suffix follows the last value and must
+        // start with a comma like the field segments; keys past maxFields are
+        // left out
+        ResponseTemplate(const char **keys, int count, std::string suffix);
+
+        // Fills parts with the object for the fields whose bit is set in mask,
+        // values are referenced in place. Returns the number of parts used.
+        int gather(iovec *parts, const char *const *begin, const char *const *end, int mask) const;
+    };
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_RESPONSETEMPLATE_H
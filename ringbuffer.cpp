@@ -0,0 +1,47 @@
+#include "ringbuffer.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <stdio.h>
+
+namespace bhft {
+
+    bool MirroredBuffer::init(size_t minCapacity) {
+        size_t size = sysconf(_SC_PAGESIZE);
+        while (size < minCapacity) size <<= 1;
+        int fd = memfd_create("bhft-ring", MFD_CLOEXEC);
+        if (fd < 0) {
+            perror("memfd_create");
+            return false;
+        }
+        if (ftruncate(fd, (off_t) size) != 0) {
+            perror("ftruncate");
+            ::close(fd);
+            return false;
+        }
+        // reserve both halves first so the second mapping can't land on anything else
+        void *area = mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (area == MAP_FAILED) {
+            perror("mmap");
+            ::close(fd);
+            return false;
+        }
+        auto *first = static_cast<char *>(area);
+        if (mmap(first, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | MAP_POPULATE, fd, 0) == MAP_FAILED ||
+            mmap(first + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            perror("mmap");
+            munmap(area, 2 * size);
+            ::close(fd);
+            return false;
+        }
+        ::close(fd);
+        data = first;
+        capacity = size;
+        return true;
+    }
+
+    MirroredBuffer::~MirroredBuffer() {
+        if (data != nullptr) munmap(data, 2 * capacity);
+    }
+
+} // bhft
@@ -0,0 +1,56 @@
+#ifndef HFT_FRAMEWORK_USERDATA_RINGBUFFER_H
+#define HFT_FRAMEWORK_USERDATA_RINGBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bhft {
+
+    // Byte ring whose storage is mapped twice back to back, so the readable
+    // bytes and the free space are always contiguous in memory. Bytes between
+    // retained and head are already consumed but still referenced by the
+    // caller and are not overwritten until release().
+    struct MirroredBuffer {
+        char *data = nullptr;
+        size_t capacity = 0;
+        uint64_t retained = 0;
+        uint64_t head = 0;
+        uint64_t tail = 0;
+
+        // Rounds capacity up to a power of two multiple of the page size.
+        bool init(size_t minCapacity);
+
+        ~MirroredBuffer();
+
+        char *readPtr() {
+            return data + (head & (capacity - 1));
+        }
+
+        char *writePtr() {
+            return data + (tail & (capacity - 1));
+        }
+
+        size_t size() {
+            return tail - head;
+        }
+
+        size_t space() {
+            return capacity - (tail - retained);
+        }
+
+        void produce(size_t count) {
+            tail += count;
+        }
+
+        void consume(size_t count) {
+            head += count;
+        }
+
+        void release() {
+            retained = head;
+        }
+    };
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_RINGBUFFER_H
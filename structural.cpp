@@ -0,0 +1,255 @@
+#include "structural.h"
+
+#include <immintrin.h>
+#include <string.h>
+
+namespace bparser {
+
+    // One bit per byte of a 64 byte block.
+    struct BlockMasks {
+        uint64_t quote;
+        uint64_t backslash;
+        uint64_t whitespace;
+        uint64_t op;
+    };
+
+    // What a block hands to the next one.
+    struct ScanState {
+        // the previous block ended in an odd run of backslashes
+        uint64_t oddBackslash = 0;
+        // all ones while a string is open
+        uint64_t inString = 0;
+        // the previous block ended inside a bare value
+        uint64_t nonQuoteScalar = 0;
+    };
+
+    static inline uint64_t prefixXor(uint64_t bits) {
+        bits ^= bits << 1;
+        bits ^= bits << 2;
+        bits ^= bits << 4;
+        bits ^= bits << 8;
+        bits ^= bits << 16;
+        bits ^= bits << 32;
+        return bits;
+    }
+
+    // Bytes preceded by an odd run of backslashes, as in simdjson's stage 1.
+    static inline uint64_t escaped(uint64_t backslash, uint64_t &oddBackslash) {
+        const uint64_t evenBits = 0x5555555555555555ull;
+        uint64_t startEdges = backslash & ~(backslash << 1);
+        uint64_t evenStartMask = evenBits ^ oddBackslash;
+        uint64_t evenStarts = startEdges & evenStartMask;
+        uint64_t oddStarts = startEdges & ~evenStartMask;
+        uint64_t evenCarries = backslash + evenStarts;
+        uint64_t oddCarries;
+        bool endsOdd = __builtin_add_overflow(backslash, oddStarts, &oddCarries);
+        oddCarries |= oddBackslash;
+        oddBackslash = endsOdd ? 1 : 0;
+        uint64_t evenCarryEnds = evenCarries & ~backslash;
+        uint64_t oddCarryEnds = oddCarries & ~backslash;
+        return (evenCarryEnds & ~evenBits) | (oddCarryEnds & evenBits);
+    }
+
+    // Appends the block's offsets, -1 when they might not fit.
+    static inline int emit(const BlockMasks &masks, ScanState &state, uint32_t base, uint32_t *positions,
+                           int count, int capacity) {
+        uint64_t quote = masks.quote & ~escaped(masks.backslash, state.oddBackslash);
+        uint64_t inString = prefixXor(quote) ^ state.inString;
+        state.inString = (uint64_t) ((int64_t) inString >> 63);
+        // string contents and closing quotes, the opening quote is a value start
+        uint64_t stringTail = inString ^ quote;
+        uint64_t scalar = ~(masks.op | masks.whitespace);
+        uint64_t nonQuoteScalar = scalar & ~quote;
+        uint64_t followsNonQuoteScalar = nonQuoteScalar << 1 | state.nonQuoteScalar;
+        state.nonQuoteScalar = nonQuoteScalar >> 63;
+        uint64_t bits = ((masks.op | (scalar & ~followsNonQuoteScalar)) & ~stringTail) | quote;
+        if (count > capacity - 64) return bits == 0 ? count : -1;
+        while (bits != 0) {
+            positions[count++] = base + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+        return count;
+    }
+
+    static inline void classifyScalar(const char *block, BlockMasks &masks) {
+        masks = {};
+        for (int i = 0; i < 64; ++i) {
+            uint64_t bit = 1ull << i;
+            switch (block[i]) {
+                case '"':
+                    masks.quote |= bit;
+                    break;
+                case '\\':
+                    masks.backslash |= bit;
+                    break;
+                case ' ':
+                case '\t':
+                case '\n':
+                case '\r':
+                    masks.whitespace |= bit;
+                    break;
+                case '{':
+                case '}':
+                case '[':
+                case ']':
+                case ':':
+                case ',':
+                    masks.op |= bit;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    static int scanScalar(const char *begin, size_t length, uint32_t *positions, int capacity) {
+        ScanState state;
+        BlockMasks masks;
+        int count = 0;
+        size_t offset = 0;
+        for (; offset + 64 <= length && count >= 0; offset += 64) {
+            classifyScalar(begin + offset, masks);
+            count = emit(masks, state, offset, positions, count, capacity);
+        }
+        if (offset < length && count >= 0) {
+            // spaces past the end add nothing
+            char tail[64];
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, begin + offset, length - offset);
+            classifyScalar(tail, masks);
+            count = emit(masks, state, offset, positions, count, capacity);
+        }
+        return state.inString != 0 ? -1 : count;
+    }
+
+    __attribute__((target("avx2")))
+    static inline uint64_t equalMaskAvx2(__m256i low, __m256i high, char c) {
+        __m256i needle = _mm256_set1_epi8(c);
+        auto lowBits = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(low, needle));
+        auto highBits = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(high, needle));
+        return lowBits | (uint64_t) highBits << 32;
+    }
+
+    __attribute__((target("avx2")))
+    static inline void classifyAvx2(const char *block, BlockMasks &masks) {
+        __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+        __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32));
+        masks.quote = equalMaskAvx2(low, high, '"');
+        masks.backslash = equalMaskAvx2(low, high, '\\');
+        masks.whitespace = equalMaskAvx2(low, high, ' ') | equalMaskAvx2(low, high, '\t') |
+                           equalMaskAvx2(low, high, '\n') | equalMaskAvx2(low, high, '\r');
+        masks.op = equalMaskAvx2(low, high, '{') | equalMaskAvx2(low, high, '}') | equalMaskAvx2(low, high, '[') |
+                   equalMaskAvx2(low, high, ']') | equalMaskAvx2(low, high, ':') | equalMaskAvx2(low, high, ',');
+    }
+
+    __attribute__((target("avx2")))
+    static int scanAvx2(const char *begin, size_t length, uint32_t *positions, int capacity) {
+        ScanState state;
+        BlockMasks masks;
+        int count = 0;
+        size_t offset = 0;
+        for (; offset + 64 <= length && count >= 0; offset += 64) {
+            classifyAvx2(begin + offset, masks);
+            count = emit(masks, state, offset, positions, count, capacity);
+        }
+        if (offset < length && count >= 0) {
+            char tail[64];
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, begin + offset, length - offset);
+            classifyAvx2(tail, masks);
+            count = emit(masks, state, offset, positions, count, capacity);
+        }
+        return state.inString != 0 ? -1 : count;
+    }
+
+    __attribute__((target("avx512f,avx512bw,bmi2")))
+    static inline void classifyAvx512(__m512i block, BlockMasks &masks) {
+        masks.quote = _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8('"'));
+        masks.backslash = _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8('\\'));
+        masks.whitespace = _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8(' ')) |
+                           _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8('\t')) |
+                           _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8('\n')) |
+                           _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8('\r'));
+        masks.op = _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8('{')) |
+                   _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8('}')) |
+                   _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8('[')) |
+                   _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8(']')) |
+                   _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8(':')) |
+                   _mm512_cmpeq_epi8_mask(block, _mm512_set1_epi8(','));
+    }
+
+    __attribute__((target("avx512f,avx512bw,bmi2")))
+    static int scanAvx512(const char *begin, size_t length, uint32_t *positions, int capacity) {
+        ScanState state;
+        BlockMasks masks;
+        int count = 0;
+        size_t offset = 0;
+        for (; offset + 64 <= length && count >= 0; offset += 64) {
+            classifyAvx512(_mm512_loadu_si512(begin + offset), masks);
+            count = emit(masks, state, offset, positions, count, capacity);
+        }
+        if (offset < length && count >= 0) {
+            // masked load never touches bytes past the end, spaces fill the rest
+            __mmask64 tail = _bzhi_u64(~0ull, (unsigned) (length - offset));
+            classifyAvx512(_mm512_mask_loadu_epi8(_mm512_set1_epi8(' '), tail, begin + offset), masks);
+            count = emit(masks, state, offset, positions, count, capacity);
+        }
+        return state.inString != 0 ? -1 : count;
+    }
+
+    static bool always() {
+        return true;
+    }
+
+    static bool hasAvx2() {
+        return __builtin_cpu_supports("avx2");
+    }
+
+    static bool hasAvx512() {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+               __builtin_cpu_supports("bmi2");
+    }
+
+    const ScanKernel scanKernels[] = {
+            {"scalar", scanScalar, always},
+            {"avx2",   scanAvx2,   hasAvx2},
+            {"avx512", scanAvx512, hasAvx512},
+    };
+    const int scanKernelCount = sizeof(scanKernels) / sizeof(scanKernels[0]);
+
+    static const ScanKernel *selectBest() {
+        __builtin_cpu_init();
+        for (int i = scanKernelCount - 1; i > 0; --i) {
+            if (scanKernels[i].supported()) return &scanKernels[i];
+        }
+        return &scanKernels[0];
+    }
+
+    static const ScanKernel *selected = selectBest();
+
+    bool StructuralIndex::build(const char *begin, const char *end) {
+        auto length = (size_t) (end - begin);
+        count = length >= UINT32_MAX ? -1 : selected->function(begin, length, positions, capacity);
+        if (count < 0) {
+            count = 0;
+            return false;
+        }
+        positions[count] = (uint32_t) length;
+        return true;
+    }
+
+    const char *scanKernelName() {
+        return selected->name;
+    }
+
+    bool selectScanKernel(const char *name) {
+        for (int i = 0; i < scanKernelCount; ++i) {
+            if (strcmp(scanKernels[i].name, name) == 0 && scanKernels[i].supported()) {
+                selected = &scanKernels[i];
+                return true;
+            }
+        }
+        return false;
+    }
+
+} // bparser
@@ -0,0 +1,44 @@
+#ifndef HFT_FRAMEWORK_USERDATA_STRUCTURAL_H
+#define HFT_FRAMEWORK_USERDATA_STRUCTURAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bparser {
+
+    // Offsets of everything the parser stops at, found 64 bytes at a time:
+    // {}[]:, outside strings, the quotes around strings and the first byte
+    // of every other value. Escapes and string contents are settled here, so
+    // the parser jumps from one offset to the next instead of testing bytes.
+    struct StructuralIndex {
+        static const int capacity = 8192;
+
+        // ascending, followed by the message length as a sentinel
+        uint32_t positions[capacity + 1];
+        int count = 0;
+
+        // false if there are more than capacity offsets or a string is left
+        // open, the parser then scans bytes as before
+        bool build(const char *begin, const char *end);
+    };
+
+    typedef int (*structuralScanner)(const char *begin, size_t length, uint32_t *positions, int capacity);
+
+    struct ScanKernel {
+        const char *name;
+        structuralScanner function;
+
+        bool (*supported)();
+    };
+
+    extern const ScanKernel scanKernels[];
+    extern const int scanKernelCount;
+
+    const char *scanKernelName();
+
+    // Overrides the startup choice, returns false for unknown or unsupported kernels.
+    bool selectScanKernel(const char *name);
+
+} // bparser
+
+#endif //HFT_FRAMEWORK_USERDATA_STRUCTURAL_H
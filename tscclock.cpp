@@ -0,0 +1,61 @@
+#include "tscclock.h"
+#include <cpuid.h>
+
+namespace bhft {
+
+    TscClock tscClock;
+
+    static bool hasInvariantTsc() {
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+        return (edx & (1u << 8)) != 0;
+    }
+
+    // TSC reading taken as close as possible to a clock_gettime: the pair with
+    // the shortest bracket out of a few tries.
+    static void sample(uint64_t &ticks, uint64_t &nanoSec) {
+        uint64_t best = ~0ull;
+        for (int i = 0; i < 5; ++i) {
+            uint64_t before = __rdtsc();
+            uint64_t now = systemNanoSec(CLOCK_MONOTONIC);
+            uint64_t after = __rdtsc();
+            if (after - before < best) {
+                best = after - before;
+                ticks = before + (after - before) / 2;
+                nanoSec = now;
+            }
+        }
+    }
+
+    bool TscClock::calibrate(uint64_t calibrationMicroSec) {
+        invariantTsc = hasInvariantTsc();
+        if (!invariantTsc) {
+            disableTsc();
+            return false;
+        }
+        uint64_t startTicks, startNanoSec, endTicks, endNanoSec;
+        sample(startTicks, startNanoSec);
+        do {
+            sample(endTicks, endNanoSec);
+        } while (endNanoSec - startNanoSec < calibrationMicroSec * 1000);
+        ticksPerNanoSec = (double) (endTicks - startTicks) / (endNanoSec - startNanoSec);
+        multiplier = (uint64_t) ((double) (1ull << 32) / ticksPerNanoSec);
+        baseTicks = endTicks;
+        baseNanoSec = endNanoSec;
+        baseWallNanoSec = systemNanoSec(CLOCK_REALTIME);
+        useTsc = true;
+        return true;
+    }
+
+    void TscClock::disableTsc() {
+        useTsc = false;
+        multiplier = 1ull << 32;
+        ticksPerNanoSec = 1;
+        baseNanoSec = systemNanoSec(CLOCK_MONOTONIC);
+        baseTicks = baseNanoSec;
+        baseWallNanoSec = systemNanoSec(CLOCK_REALTIME);
+    }
+
+    static bool calibrated = tscClock.calibrate(10000);
+
+} // bhft
@@ -0,0 +1,62 @@
+#ifndef HFT_FRAMEWORK_USERDATA_TSCCLOCK_H
+#define HFT_FRAMEWORK_USERDATA_TSCCLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <x86intrin.h>
+
+namespace bhft {
+
+    // Monotonic clock on the time stamp counter, calibrated against
+    // CLOCK_MONOTONIC once at startup. Without an invariant TSC (the rate
+    // would follow frequency scaling and stop in deep C-states) ticks fall
+    // back to CLOCK_MONOTONIC nanoseconds, so callers never need to care.
+    struct TscClock {
+        bool useTsc = false;
+        bool invariantTsc = false;
+        uint64_t baseTicks = 0;
+        uint64_t baseNanoSec = 0;
+        uint64_t baseWallNanoSec = 0;
+        // nanoseconds per tick, 32.32 fixed point
+        uint64_t multiplier = 1ull << 32;
+        double ticksPerNanoSec = 1;
+
+        // Measures the TSC rate over calibrationMicroSec, falls back when
+        // the TSC is not invariant. Called from a static initializer.
+        bool calibrate(uint64_t calibrationMicroSec);
+
+        // Forces the CLOCK_MONOTONIC fallback, only before threads start taking timestamps.
+        void disableTsc();
+    };
+
+    extern TscClock tscClock;
+
+    inline uint64_t systemNanoSec(clockid_t clock) {
+        timespec now;
+        clock_gettime(clock, &now);
+        return now.tv_sec * 1000000000ull + now.tv_nsec;
+    }
+
+    // Raw ticks, for intervals convert the difference with ticksToNanoSec.
+    inline uint64_t tscTicks() {
+        return tscClock.useTsc ? __rdtsc() : systemNanoSec(CLOCK_MONOTONIC);
+    }
+
+    inline uint64_t ticksToNanoSec(uint64_t ticks) {
+        if (!tscClock.useTsc) return ticks;
+        return (uint64_t) (((unsigned __int128) ticks * tscClock.multiplier) >> 32);
+    }
+
+    inline uint64_t monotonicNanoSec() {
+        return tscClock.baseNanoSec + ticksToNanoSec(tscTicks() - tscClock.baseTicks);
+    }
+
+    // Wall clock derived from the TSC, for log timestamps. Does not follow NTP
+    // steps made after startup.
+    inline uint64_t wallNanoSec() {
+        return tscClock.baseWallNanoSec + ticksToNanoSec(tscTicks() - tscClock.baseTicks);
+    }
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_TSCCLOCK_H
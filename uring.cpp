@@ -0,0 +1,382 @@
+#include "uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+namespace bhft {
+
+    // user_data of every request: the connection slot and what it was for
+    static const uint64_t recvTag = 1;
+    static const uint64_t sendTag = 2;
+    static const uint64_t cancelTag = 3;
+
+    static uint64_t tag(int slot, uint64_t kind) {
+        return (uint64_t) slot << 8 | kind;
+    }
+
+    static int ioUringSetup(unsigned entries, io_uring_params *params) {
+        return (int) syscall(__NR_io_uring_setup, entries, params);
+    }
+
+    static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+    }
+
+    static int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned count) {
+        return (int) syscall(__NR_io_uring_register, fd, opcode, arg, count);
+    }
+
+    template<typename T>
+    static T *at(void *base, unsigned offset) {
+        return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+    }
+
+    static thread_local Uring *threadRing = nullptr;
+    static thread_local bool threadRingFailed = false;
+
+    Uring *Uring::forThread() {
+        if (threadRing == nullptr && !threadRingFailed) {
+            threadRing = new Uring();
+            if (!threadRing->init()) {
+                delete threadRing;
+                threadRing = nullptr;
+                threadRingFailed = true;
+            }
+        }
+        return threadRing;
+    }
+
+    void Uring::submitForThread() {
+        if (threadRing != nullptr) threadRing->submit();
+    }
+
+    bool Uring::init() {
+        io_uring_params params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        // every connection may have a full buffer group of recv completions queued
+        params.cq_entries = completionEntries;
+        ringFd = ioUringSetup(entries, &params);
+        if (ringFd < 0) {
+            perror("io_uring_setup");
+            return false;
+        }
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                      IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            sqRing = nullptr;
+            return false;
+        }
+        if (singleMmap) {
+            cqRing = sqRing;
+        } else {
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                          IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED) {
+                cqRing = nullptr;
+                return false;
+            }
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            sqes = nullptr;
+            return false;
+        }
+        sqHead = at<unsigned>(sqRing, params.sq_off.head);
+        sqTail = at<unsigned>(sqRing, params.sq_off.tail);
+        sqFlags = at<unsigned>(sqRing, params.sq_off.flags);
+        sqMask = *at<unsigned>(sqRing, params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        sqArray = at<unsigned>(sqRing, params.sq_off.array);
+        cqHead = at<unsigned>(cqRing, params.cq_off.head);
+        cqTail = at<unsigned>(cqRing, params.cq_off.tail);
+        cqMask = *at<unsigned>(cqRing, params.cq_off.ring_mask);
+        cqes = at<io_uring_cqe>(cqRing, params.cq_off.cqes);
+
+        // one registered buffer slot per connection, filled in by attach()
+        io_uring_rsrc_register sparse{};
+        sparse.nr = maxConnections;
+        sparse.flags = IORING_RSRC_REGISTER_SPARSE;
+        fixedBuffers = ioUringRegister(ringFd, IORING_REGISTER_BUFFERS2, &sparse, sizeof(sparse)) == 0;
+        return true;
+    }
+
+    Uring::~Uring() {
+        if (sqes != nullptr) munmap(sqes, sqesSize);
+        if (cqRing != nullptr && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != nullptr) munmap(sqRing, sqRingSize);
+        if (ringFd >= 0) ::close(ringFd);
+    }
+
+    UringConnection *Uring::attach(int socket, const char *fixed, size_t fixedSize) {
+        int slot = 0;
+        while (slot < maxConnections && connections[slot] != nullptr) ++slot;
+        if (slot == maxConnections) {
+            fprintf(stderr, "io_uring: more than %i connections on one thread\n", maxConnections);
+            return nullptr;
+        }
+        auto *connection = new UringConnection();
+        connection->slot = slot;
+        connection->socket = socket;
+
+        // the connection's own provided buffer group for the multishot recv
+        size_t ringSize = UringConnection::bufferCount * sizeof(io_uring_buf);
+        connection->buffersSize = ringSize + UringConnection::bufferCount * UringConnection::bufferSize;
+        void *memory = mmap(nullptr, connection->buffersSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (memory == MAP_FAILED) {
+            delete connection;
+            return nullptr;
+        }
+        connection->bufferRing = static_cast<io_uring_buf_ring *>(memory);
+        connection->buffers = static_cast<char *>(memory) + ringSize;
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(connection->bufferRing);
+        reg.ring_entries = UringConnection::bufferCount;
+        reg.bgid = slot;
+        if (ioUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            perror("io_uring_register(PBUF_RING)");
+            delete connection;
+            return nullptr;
+        }
+        connection->ring = this;
+        connections[slot] = connection;
+        for (unsigned i = 0; i < UringConnection::bufferCount; ++i) {
+            connection->recycle((int) i);
+        }
+
+        if (fixed != nullptr && fixedBuffers) {
+            iovec iov{const_cast<char *>(fixed), fixedSize};
+            io_uring_rsrc_update2 update{};
+            update.offset = slot;
+            update.data = reinterpret_cast<uint64_t>(&iov);
+            update.nr = 1;
+            if (ioUringRegister(ringFd, IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update)) == 1) {
+                connection->fixedIndex = slot;
+                connection->fixedBuffer = fixed;
+                connection->fixedBufferSize = fixedSize;
+            }
+        }
+        connection->armRecv();
+        if (enter(unsubmitted, 0) < 0) {
+            delete connection;
+            return nullptr;
+        }
+        return connection;
+    }
+
+    void Uring::detach(UringConnection *connection) {
+        int slot = connection->slot;
+        if (connection->recvArmed) {
+            io_uring_sqe *sqe = nextSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = tag(slot, recvTag);
+            sqe->user_data = tag(slot, cancelTag);
+        }
+        if (connection->sending) {
+            io_uring_sqe *sqe = nextSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = tag(slot, sendTag);
+            sqe->user_data = tag(slot, cancelTag);
+        }
+        // a send still references the socket's outbound queue, which goes away next
+        while (connection->recvArmed || connection->sending) {
+            if (enter(unsubmitted, 1) < 0) break;
+            reap();
+        }
+        io_uring_buf_reg reg{};
+        reg.bgid = slot;
+        ioUringRegister(ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        if (connection->fixedIndex >= 0) {
+            iovec iov{nullptr, 0};
+            io_uring_rsrc_update2 update{};
+            update.offset = slot;
+            update.data = reinterpret_cast<uint64_t>(&iov);
+            update.nr = 1;
+            ioUringRegister(ringFd, IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update));
+        }
+        connections[slot] = nullptr;
+    }
+
+    io_uring_sqe *Uring::nextSqe() {
+        unsigned tail = *sqTail;
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries) {
+            enter(unsubmitted, 0);
+        }
+        unsigned index = tail & sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++unsubmitted;
+        return sqe;
+    }
+
+    int Uring::enter(unsigned toSubmit, unsigned minComplete) {
+        while (true) {
+            int ret = ioUringEnter(ringFd, toSubmit, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0);
+            if (ret >= 0) {
+                unsubmitted -= std::min((unsigned) ret, toSubmit);
+                return ret;
+            }
+            if (errno != EINTR) return ret;
+        }
+    }
+
+    void Uring::submit() {
+        if (unsubmitted != 0) enter(unsubmitted, 0);
+    }
+
+    void Uring::wait() {
+        enter(unsubmitted, 1);
+        reap();
+    }
+
+    void Uring::reap() {
+        while (true) {
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const io_uring_cqe &cqe = cqes[head & cqMask];
+                auto slot = (int) (cqe.user_data >> 8);
+                if (slot < maxConnections && connections[slot] != nullptr) {
+                    connections[slot]->completed(cqe.user_data & 0xff, cqe.res, cqe.flags);
+                }
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            // completions the kernel could not post are flushed by an enter
+            if (!(__atomic_load_n(sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW)) return;
+            ioUringEnter(ringFd, 0, 0, IORING_ENTER_GETEVENTS);
+        }
+    }
+
+    UringConnection::~UringConnection() {
+        if (ring != nullptr) ring->detach(this);
+        if (bufferRing != nullptr) munmap(bufferRing, buffersSize);
+    }
+
+    void UringConnection::armRecv() {
+        io_uring_sqe *sqe = ring->nextSqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = socket;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = slot;
+        sqe->user_data = tag(slot, recvTag);
+        recvArmed = true;
+    }
+
+    void UringConnection::recycle(int bufferId) {
+        // not bufferRing->bufs: the kernel's flex-array macro puts an empty
+        // struct in front of it, which is one byte (padded to eight) in C++
+        io_uring_buf &buf = reinterpret_cast<io_uring_buf *>(bufferRing)[bufferTail & (bufferCount - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(buffers + (size_t) bufferId * bufferSize);
+        buf.len = bufferSize;
+        buf.bid = bufferId;
+        ++bufferTail;
+        __atomic_store_n(&bufferRing->tail, bufferTail, __ATOMIC_RELEASE);
+    }
+
+    void UringConnection::completed(unsigned kind, int res, unsigned flags) {
+        if (kind == recvTag) {
+            if (!(flags & IORING_CQE_F_MORE)) recvArmed = false;
+            unsigned next = (receivedEnd + 1) % (bufferCount + 2);
+            if (next != receivedBegin) {
+                received[receivedEnd] = {res, flags};
+                receivedEnd = next;
+            } else if (flags & IORING_CQE_F_BUFFER) {
+                recycle((int) (flags >> IORING_CQE_BUFFER_SHIFT));
+            }
+        } else if (kind == sendTag) {
+            sending = false;
+            if (res < 0) {
+                sendError = -res;
+            } else {
+                sent += res;
+            }
+        }
+    }
+
+    ssize_t UringConnection::receive(char *&begin, char *&end) {
+        if (heldBuffer >= 0) {
+            recycle(heldBuffer);
+            heldBuffer = -1;
+        }
+        if (receivedBegin == receivedEnd) ring->reap();
+        if (receivedBegin == receivedEnd) {
+            if (!recvArmed) {
+                armRecv();
+                ring->enter(ring->unsubmitted, 0);
+            }
+            errno = EAGAIN;
+            return -1;
+        }
+        Completion completion = received[receivedBegin];
+        receivedBegin = (receivedBegin + 1) % (bufferCount + 2);
+        if (completion.res == -ENOBUFS || completion.res == -EAGAIN) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (completion.res <= 0) {
+            errno = -completion.res;
+            return completion.res == 0 ? 0 : -1;
+        }
+        heldBuffer = (int) (completion.flags >> IORING_CQE_BUFFER_SHIFT);
+        begin = buffers + (size_t) heldBuffer * bufferSize;
+        end = begin + completion.res;
+        return completion.res;
+    }
+
+    void UringConnection::wait() {
+        if (receivedBegin != receivedEnd) return;
+        if (!recvArmed) armRecv();
+        ring->wait();
+    }
+
+    bool UringConnection::send(const char *src, size_t count) {
+        io_uring_sqe *sqe = ring->nextSqe();
+        // the socket is blocking, so the kernel arms a poll when its buffer
+        // is full and completes the send later instead of failing
+        if (fixedIndex >= 0 && src >= fixedBuffer && src + count <= fixedBuffer + fixedBufferSize) {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->buf_index = fixedIndex;
+        } else {
+            sqe->opcode = IORING_OP_SEND;
+        }
+        sqe->fd = socket;
+        sqe->addr = reinterpret_cast<uint64_t>(src);
+        sqe->len = count;
+        sqe->user_data = tag(slot, sendTag);
+        sending = true;
+        return ring->deferSubmit || ring->enter(ring->unsubmitted, 0) >= 0;
+    }
+
+    ssize_t UringConnection::takeSent() {
+        if (sending) ring->reap();
+        if (sendError != 0) {
+            errno = sendError;
+            return -1;
+        }
+        size_t count = sent;
+        sent = 0;
+        return (ssize_t) count;
+    }
+
+    int UringConnection::pollFd() {
+        return ring->ringFd;
+    }
+
+} // bhft
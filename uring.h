@@ -0,0 +1,155 @@
+#ifndef HFT_FRAMEWORK_USERDATA_URING_H
+#define HFT_FRAMEWORK_USERDATA_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace bhft {
+
+    struct Uring;
+
+    // One socket's share of its thread's ring. Receives run as a single
+    // multishot recv into the connection's own group of provided buffers, so
+    // polling for data is a memory read instead of a syscall. Sends complete
+    // asynchronously: the bytes stay where they are until takeSent() reports
+    // them, and the socket keeps at most one send in flight.
+    struct UringConnection {
+        static const unsigned bufferCount = 64;
+        static const unsigned bufferSize = 2048;
+
+        struct Completion {
+            int res;
+            unsigned flags;
+        };
+
+        Uring *ring = nullptr;
+        int slot = -1;
+        int socket = -1;
+
+        io_uring_buf_ring *bufferRing = nullptr;
+        char *buffers = nullptr;
+        size_t buffersSize = 0;
+        unsigned short bufferTail = 0;
+        int heldBuffer = -1;
+        bool recvArmed = false;
+        // recv completions reaped by the ring for this connection
+        Completion received[bufferCount + 2];
+        unsigned receivedBegin = 0;
+        unsigned receivedEnd = 0;
+
+        // registered buffer sends are issued from, -1 for plain sends
+        int fixedIndex = -1;
+        const char *fixedBuffer = nullptr;
+        size_t fixedBufferSize = 0;
+        bool sending = false;
+        // bytes finished sends took since the last takeSent()
+        size_t sent = 0;
+        int sendError = 0;
+
+        ~UringConnection();
+
+        // Same contract as ::recv: bytes received, 0 on EOF, -1 with errno set
+        // (EAGAIN when nothing has completed yet). The data stays valid until
+        // the next call.
+        ssize_t receive(char *&begin, char *&end);
+
+        // Blocks until a completion for any connection of the ring arrives.
+        void wait();
+
+        // Starts sending [src, src + count), false if the ring is gone.
+        bool send(const char *src, size_t count);
+
+        bool sendInFlight() {
+            return sending;
+        }
+
+        // Bytes sent since the last call, -1 with errno set once a send failed.
+        ssize_t takeSent();
+
+        int pollFd();
+
+    private:
+        friend struct Uring;
+
+        void armRecv();
+
+        void recycle(int bufferId);
+
+        void completed(unsigned kind, int res, unsigned flags);
+    };
+
+    // io_uring of one thread, shared by every connection the thread owns, so
+    // one io_uring_enter submits and reaps for all of them. A reactor thread
+    // sets deferSubmit: sends are then only queued until submit(), which it
+    // calls once per pass over the ready connections.
+    struct Uring {
+        static const unsigned entries = 256;
+        static const unsigned completionEntries = 4096;
+        static const int maxConnections = 32;
+
+        int ringFd = -1;
+        bool deferSubmit = false;
+
+        void *sqRing = nullptr;
+        size_t sqRingSize = 0;
+        void *cqRing = nullptr;
+        size_t cqRingSize = 0;
+        io_uring_sqe *sqes = nullptr;
+        size_t sqesSize = 0;
+        unsigned *sqHead = nullptr;
+        unsigned *sqTail = nullptr;
+        unsigned *sqFlags = nullptr;
+        unsigned sqMask = 0;
+        unsigned sqEntries = 0;
+        unsigned *sqArray = nullptr;
+        unsigned *cqHead = nullptr;
+        unsigned *cqTail = nullptr;
+        unsigned cqMask = 0;
+        io_uring_cqe *cqes = nullptr;
+        // queued but not yet passed to io_uring_enter
+        unsigned unsubmitted = 0;
+        // a sparse table of maxConnections registered buffers
+        bool fixedBuffers = false;
+
+        UringConnection *connections[maxConnections] = {};
+
+        // The calling thread's ring, created on first use; null if io_uring
+        // is unavailable.
+        static Uring *forThread();
+
+        // submit() on the calling thread's ring if it has one.
+        static void submitForThread();
+
+        ~Uring();
+
+        // Takes over a connected blocking socket. fixed/fixedSize is registered
+        // for its sends and may be null.
+        UringConnection *attach(int socket, const char *fixed, size_t fixedSize);
+
+        // Cancels the connection's requests and waits for them to finish.
+        void detach(UringConnection *connection);
+
+        // Hands every completion in the queue to its connection.
+        void reap();
+
+        void submit();
+
+        // Blocks until at least one completion is queued.
+        void wait();
+
+    private:
+        friend struct UringConnection;
+
+        bool init();
+
+        io_uring_sqe *nextSqe();
+
+        int enter(unsigned toSubmit, unsigned minComplete);
+    };
+
+} // bhft
+
+#endif //HFT_FRAMEWORK_USERDATA_URING_H